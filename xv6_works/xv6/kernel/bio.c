@@ -5,6 +5,15 @@
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Buffers come from a slab cache. There are normally NBUF of
+// them; if every buffer is in use, bget() allocates another
+// rather than failing, and brelse() frees the extras again.
+//
+// bcache.lock is a reader-writer lock. A cache hit only reads
+// the list, taking it for reading and counting itself into
+// b->refcnt with an atomic add; a miss, and everything that
+// drops a reference or moves a buffer, takes it for writing.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -24,8 +33,9 @@
 #include "buf.h"
 
 struct {
-  struct spinlock lock;
-  struct buf buf[NBUF];
+  struct rwspinlock lock;
+  struct kmem_cache *cache;
+  int nbuf;
 
   // Linked list of all buffers, through prev/next.
   // Sorted by how recently the buffer was used.
@@ -33,23 +43,43 @@ struct {
   struct buf head;
 } bcache;
 
-void
-binit(void)
+// Allocate a buffer and put it at the head of the list.
+// Caller must hold bcache.lock for writing.
+static struct buf*
+balloc(void)
 {
   struct buf *b;
 
-  initlock(&bcache.lock, "bcache");
+  if((b = kmem_cache_alloc(bcache.cache)) == 0)
+    return 0;
+  b->valid = 0;
+  b->disk = 0;
+  b->dev = 0;
+  b->blockno = 0;
+  b->refcnt = 0;
+  initsleeplock(&b->lock, "buffer");
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+  bcache.nbuf++;
+  return b;
+}
+
+void
+binit(void)
+{
+  initrwlock(&bcache.lock, "bcache");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf));
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+  acquirewrite(&bcache.lock);
+  for(int i = 0; i < NBUF; i++)
+    if(balloc() == 0)
+      panic("binit");
+  releasewrite(&bcache.lock);
 }
 
 // Look through buffer cache for block on device dev.
@@ -60,13 +90,25 @@ bget(uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
   // Is the block already cached?
+  acquireread(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      __sync_fetch_and_add(&b->refcnt, 1);
+      releaseread(&bcache.lock);
+      acquiresleep(&b->lock);
+      return b;
+    }
+  }
+  releaseread(&bcache.lock);
+
+  // Look again for writing, since another
+  // process may have read it in in between.
+  acquirewrite(&bcache.lock);
   for(b = bcache.head.next; b != &bcache.head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
+      releasewrite(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
@@ -80,12 +122,21 @@ bget(uint dev, uint blockno)
       b->blockno = blockno;
       b->valid = 0;
       b->refcnt = 1;
-      release(&bcache.lock);
+      releasewrite(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
-  panic("bget: no buffers");
+
+  // All in use; grow the cache.
+  if((b = balloc()) == 0)
+    panic("bget: no buffers");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->refcnt = 1;
+  releasewrite(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -112,7 +163,8 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Move to the head of the most-recently-used list,
+// or free it if the cache has grown past NBUF.
 void
 brelse(struct buf *b)
 {
@@ -121,33 +173,39 @@ brelse(struct buf *b)
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  acquirewrite(&bcache.lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
     b->next->prev = b->prev;
     b->prev->next = b->next;
+    if(bcache.nbuf > NBUF){
+      bcache.nbuf--;
+      releasewrite(&bcache.lock);
+      kmem_cache_free(bcache.cache, b);
+      return;
+    }
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
   
-  release(&bcache.lock);
+  releasewrite(&bcache.lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  acquirewrite(&bcache.lock);
   b->refcnt++;
-  release(&bcache.lock);
+  releasewrite(&bcache.lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  acquirewrite(&bcache.lock);
   b->refcnt--;
-  release(&bcache.lock);
+  releasewrite(&bcache.lock);
 }
 
 
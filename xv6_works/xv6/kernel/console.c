@@ -80,10 +80,16 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
-  char cbuf;
-
+  int c, m;
+  char cbuf[INPUT_BUF_SIZE];
+
+  // the line is gathered in cbuf and copied out after
+  // releasing cons.lock, since copying to a page that
+  // is not yet loaded may sleep.
+  if(n > INPUT_BUF_SIZE)
+    n = INPUT_BUF_SIZE;
   target = n;
+  m = 0;
   acquire(&cons.lock);
   while(n > 0){
     // wait until interrupt handler has put some
@@ -107,12 +113,7 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
 
-    // copy the input byte to the user-space buffer.
-    cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
-
-    dst++;
+    cbuf[m++] = c;
     --n;
 
     if(c == '\n'){
@@ -123,7 +124,10 @@ consoleread(int user_dst, uint64 dst, int n)
   }
   release(&cons.lock);
 
-  return target - n;
+  // copy the input bytes to the user-space buffer.
+  if(m > 0 && either_copyout(user_dst, dst, cbuf, m) == -1)
+    return -1;
+  return m;
 }
 
 //
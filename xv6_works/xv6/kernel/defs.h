@@ -2,10 +2,20 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct kmemstat;
+struct mm;
+struct syscall_stat;
+struct lockclass;
+struct lockstat;
 struct pipe;
 struct proc;
+struct seg;
+struct vma;
 struct spinlock;
 struct sleeplock;
+struct rwspinlock;
+struct rwsleeplock;
 struct stat;
 struct superblock;
 
@@ -24,6 +34,9 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+struct seg*     segfind(struct seg*, uint64);
+int             segload(struct mm*, struct seg*, uint64);
+void            segput(struct seg*);
 
 // file.c
 struct file*    filealloc(void);
@@ -42,9 +55,11 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
+void            iunlockshared(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
@@ -61,8 +76,16 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+int             kzero_fill(void);
+void            kdup(void *);
+int             krefs(void *);
+void            ksplit(void *, int);
 void            kfree(void *);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
 void            kinit(void);
+int             kmemstats(struct kmemstat*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -70,7 +93,20 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+void            mmapinit(void);
+struct vma*     vmafind(struct mm*, uint64);
+int             vmashared(struct mm*, uint64);
+uint64          vmamap(uint64, int, int, struct file*, uint);
+int             vmafault(struct mm*, struct vma*, uint64);
+int             vmaunmap(uint64, uint64);
+int             vmafork(struct mm*, struct mm*, uint64);
+uint64          stackalloc(struct mm*, uint64);
+void            stackfree(struct mm*, uint64);
+void            vmafree(struct mm*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -85,10 +121,19 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+uint64          growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+struct mm*      mmcreate(struct proc*);
+void            mmput(struct mm*);
+void            mmdetach(struct proc*);
+int             create_thread(uint64, uint64, uint64, uint64);
+int             join_thread(int);
+int             futex_wait(uint64, uint);
+int             futex_wake(uint64, int);
+int             cond_wait(uint64, uint64);
+void            tlbshootdown(struct mm*);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -98,10 +143,19 @@ struct proc*    myproc();
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            setrunnable(struct proc*);
+int             timeslice(void);
+int             setsched(int, int);
+int             getsched(int);
+int             settickets(int);
+int             getruntime(int);
+int             setaffinity(int, uint);
+int             getaffinity(int);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeone(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -117,12 +171,35 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+struct lockclass* lockclass_get(char*, int);
+void            lockstat_acquire(struct lockclass*, int, uint64);
+void            lockstat_release(struct lockclass*, uint64);
+int             lockstat_get(int, struct lockstat*);
+void            lockstat_reset(void);
+void            initrwlock(struct rwspinlock*, char*);
+void            acquireread(struct rwspinlock*);
+void            releaseread(struct rwspinlock*);
+void            acquirewrite(struct rwspinlock*);
+void            releasewrite(struct rwspinlock*);
+int             holdingwrite(struct rwspinlock*);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            initrwsleeplock(struct rwsleeplock*, char*);
+void            acquirereadsleep(struct rwsleeplock*);
+void            releasereadsleep(struct rwsleeplock*);
+void            acquirewritesleep(struct rwsleeplock*);
+void            releasewritesleep(struct rwsleeplock*);
+int             holdingwritesleep(struct rwsleeplock*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -140,14 +217,23 @@ void            argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+int             syscallstat(int, struct syscall_stat*);
 
 // trap.c
 extern uint     ticks;
+extern uint     tickwake;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
+void            clockintr(void);
 void            usertrapret(void);
 
+// timer.c
+void            timerqinit(void);
+void            timerset(uint64);
+void            timerintr(void);
+int             nanosleep(uint64);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -165,8 +251,13 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64, struct mm*);
+int             uvmlazy(struct mm*, uint64);
+int             uvmfault(struct proc*, uint64, int);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmunmapmm(struct mm*, uint64, uint64);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
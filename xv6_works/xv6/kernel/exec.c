@@ -6,6 +6,10 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "tls.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
@@ -24,12 +28,16 @@ exec(char *path, char **argv)
 {
   char *s, *last;
   int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
+  uint64 argc, sz = 0, sp, tp, ustack[MAXARG], stackbase;
+  struct tls tls;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
+  pagetable_t pagetable;
   struct proc *p = myproc();
+  struct mm *mm = 0;
+  struct seg *sp1;
+  int nseg = 0;
 
   begin_op();
 
@@ -46,10 +54,13 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pagetable = proc_pagetable(p)) == 0)
+  // a new address space, for this thread only.
+  if((mm = mmcreate(p)) == 0)
     goto bad;
+  pagetable = mm->pagetable;
 
-  // Load program into memory.
+  // Set up program segments to be paged in from ip on first
+  // touch (segload()). Segments beyond NSEG are read now.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,6 +72,20 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr + ph.memsz >= MMAPBASE)
+      goto bad;
+    if(nseg < NSEG){
+      sp1 = &mm->seg[nseg++];
+      sp1->ip = idup(ip);
+      sp1->va = ph.vaddr;
+      sp1->memsz = ph.memsz;
+      sp1->filesz = ph.filesz;
+      sp1->off = ph.off;
+      sp1->perm = flags2perm(ph.flags);
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
@@ -73,7 +98,6 @@ exec(char *path, char **argv)
   ip = 0;
 
   p = myproc();
-  uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
   // Make the first inaccessible as a stack guard.
@@ -87,6 +111,15 @@ exec(char *path, char **argv)
   sp = sz;
   stackbase = sp - PGSIZE;
 
+  // the main thread's TLS block, at the top of the stack.
+  sp -= sizeof(tls);
+  sp -= sp % 16;
+  memset(&tls, 0, sizeof(tls));
+  tls.tid = p->pid;
+  if(copyout(pagetable, sp, (char *)&tls, sizeof(tls)) < 0)
+    goto bad;
+  tp = sp;
+
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
     if(argc >= MAXARG)
@@ -120,23 +153,26 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
-  oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
+  // Commit to the user image. Other threads
+  // go on using the old address space.
+  mm->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  p->trapframe->tp = tp;
+  mmdetach(p);
+  p->mm = mm;
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(mm){
+    mm->sz = sz;
+    mmput(mm);
+  }
   return -1;
 }
 
@@ -164,3 +200,92 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
   
   return 0;
 }
+
+// Find the segment in seg[NSEG] that holds va, or 0.
+struct seg*
+segfind(struct seg *seg, uint64 va)
+{
+  struct seg *s;
+
+  for(s = seg; s < &seg[NSEG]; s++)
+    if(s->ip && va >= s->va && va < s->va + s->memsz)
+      return s;
+  return 0;
+}
+
+// Read the page of segment s of mm holding va from the
+// program file into a new page and map it. s may be a
+// copy; mm->lock must not be held.
+// Returns 0 on success (including if another thread
+// mapped the page first, or sbrk() shrank the segment
+// away meanwhile, so that the access is retried),
+// -1 if memory is exhausted or the read fails.
+int
+segload(struct mm *mm, struct seg *s, uint64 va)
+{
+  struct seg *cur;
+  pte_t *pte;
+  char *mem;
+  uint64 n;
+  int r, locked;
+
+  va = PGROUNDDOWN(va);
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+
+  if(va - s->va < s->filesz){
+    n = s->filesz - (va - s->va);
+    if(n > PGSIZE)
+      n = PGSIZE;
+    // a read() or write() of the program file itself
+    // may already hold ip's lock while copying to or
+    // from the page that faulted.
+    locked = holdingwritesleep(&s->ip->lock);
+    if(!locked)
+      ilock(s->ip);
+    r = readi(s->ip, 0, (uint64)mem, s->off + (va - s->va), n);
+    if(!locked)
+      iunlock(s->ip);
+    if(r != n)
+      goto bad;
+  }
+
+  // the page was read in without mm->lock.
+  acquirewrite(&mm->lock);
+  if(va >= mm->sz || (cur = segfind(mm->seg, va)) == 0 ||
+     cur->ip != s->ip || cur->va != s->va || cur->off != s->off){
+    releasewrite(&mm->lock);
+    kfree(mem);
+    return 0;
+  }
+  if((pte = walk(mm->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    releasewrite(&mm->lock);
+    kfree(mem);
+    return 0;
+  }
+  r = mappages(mm->pagetable, va, PGSIZE, (uint64)mem, s->perm|PTE_R|PTE_U);
+  releasewrite(&mm->lock);
+  if(r != 0)
+    goto bad;
+  return 0;
+
+ bad:
+  kfree(mem);
+  return -1;
+}
+
+// Drop the program file references of seg[NSEG].
+// Must be called inside a transaction, since it
+// may be the last reference to an unlinked file.
+void
+segput(struct seg *seg)
+{
+  struct seg *s;
+
+  for(s = seg; s < &seg[NSEG]; s++){
+    if(s->ip){
+      iput(s->ip);
+      s->ip = 0;
+    }
+  }
+}
@@ -168,25 +168,36 @@ bfree(int dev, uint b)
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
+// It is a reader-writer lock: iget() and idup() need only read
+// the list, so they take it for reading and bump ip->ref with
+// an atomic add; anything that allocates, frees or drops a
+// reference takes it for writing.
+//
+// The table is a list of inodes allocated from a slab cache.
+// Up to NINODE entries are kept around for reuse; past that,
+// iget() allocates a new entry instead of failing and iput()
+// frees entries as their ref count drops to zero.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// ilock() takes it for writing; namex() only reads directories,
+// and takes them with ilockshared() so that path lookups through
+// the same directories need not wait for each other.
 
 struct {
-  struct spinlock lock;
-  struct inode inode[NINODE];
+  struct rwspinlock lock;
+  struct kmem_cache *cache;
+  struct inode head;    // list of all entries
+  int n;                // entries on the list
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
-  initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  initrwlock(&itable.lock, "itable");
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode));
+  itable.head.next = itable.head.prev = &itable.head;
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -248,30 +259,49 @@ iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
 
-  acquire(&itable.lock);
-
   // Is the inode already in the table?
+  acquireread(&itable.lock);
+  for(ip = itable.head.next; ip != &itable.head; ip = ip->next){
+    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+      __sync_fetch_and_add(&ip->ref, 1);
+      releaseread(&itable.lock);
+      return ip;
+    }
+  }
+  releaseread(&itable.lock);
+
+  // Look again for writing, since another
+  // process may have added it in between.
+  acquirewrite(&itable.lock);
   empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+  for(ip = itable.head.next; ip != &itable.head; ip = ip->next){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
-      release(&itable.lock);
+      releasewrite(&itable.lock);
       return ip;
     }
     if(empty == 0 && ip->ref == 0)    // Remember empty slot.
       empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Recycle an inode entry, or grow the table.
+  if(empty == 0){
+    if((empty = kmem_cache_alloc(itable.cache)) == 0)
+      panic("iget: no inodes");
+    initrwsleeplock(&empty->lock, "inode");
+    empty->next = itable.head.next;
+    empty->prev = &itable.head;
+    itable.head.next->prev = empty;
+    itable.head.next = empty;
+    itable.n++;
+  }
 
   ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&itable.lock);
+  releasewrite(&itable.lock);
 
   return ip;
 }
@@ -281,9 +311,9 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
-  ip->ref++;
-  release(&itable.lock);
+  acquireread(&itable.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
+  releaseread(&itable.lock);
   return ip;
 }
 
@@ -298,7 +328,7 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquiresleep(&ip->lock);
+  acquirewritesleep(&ip->lock);
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -320,15 +350,43 @@ ilock(struct inode *ip)
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingwritesleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  releasewritesleep(&ip->lock);
+}
+
+// Lock the given inode for reading only, sharing it
+// with other readers. Reads the inode from disk if
+// necessary. The caller must not change it.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquirereadsleep(&ip->lock);
+  while(ip->valid == 0){
+    // reading it in changes it, so that needs ilock().
+    releasereadsleep(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquirereadsleep(&ip->lock);
+  }
+}
+
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasereadsleep(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
-// be recycled.
+// be recycled, or is freed if the table is over NINODE.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -336,29 +394,35 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  acquirewrite(&itable.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
 
     // ip->ref == 1 means no other process can have ip locked,
-    // so this acquiresleep() won't block (or deadlock).
-    acquiresleep(&ip->lock);
+    // so this acquirewritesleep() won't block (or deadlock).
+    acquirewritesleep(&ip->lock);
 
-    release(&itable.lock);
+    releasewrite(&itable.lock);
 
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
-    releasesleep(&ip->lock);
+    releasewritesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquirewrite(&itable.lock);
   }
 
   ip->ref--;
-  release(&itable.lock);
+  if(ip->ref == 0 && itable.n > NINODE){
+    ip->prev->next = ip->next;
+    ip->next->prev = ip->prev;
+    itable.n--;
+    kmem_cache_free(itable.cache, ip);
+  }
+  releasewrite(&itable.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -659,21 +723,22 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
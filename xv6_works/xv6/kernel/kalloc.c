@@ -1,6 +1,31 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// The RAM between end and PHYSTOP is managed by a binary
+// buddy allocator: free memory is kept as blocks of 2^k
+// pages (k <= MAXORDER), each aligned to its own size, and
+// kalloc_pages(k) returns a physically contiguous block,
+// splitting a larger one if need be. kfree_pages() merges
+// a block with its buddy whenever the buddy is also free.
+//
+// Single pages (order 0) are the common case and are served
+// from per-CPU free lists so that kalloc()/kfree() normally
+// only touch a lock no other CPU takes. Pages move between a
+// CPU's list and the buddy allocator in batches of
+// KMEM_BATCH; when both the local list and the buddy
+// allocator are empty, kalloc() steals half of another
+// CPU's list.
+//
+// Pages are only filled with junk on kfree()/kalloc() when
+// the kernel is built with KPOISON (make KPOISON=1). Callers
+// that need a zeroed page use kalloc_zeroed(), which takes one
+// from a pool that idle CPUs keep topped up (kzero_fill()).
+//
+// Every page handed out by kalloc() has a reference count,
+// so that fork can share pages copy-on-write: kdup() adds a
+// reference and kfree() only frees the page when the last
+// one is dropped.
 
 #include "types.h"
 #include "param.h"
@@ -8,6 +33,18 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "kmemstat.h"
+
+#define KMEM_BATCH   32             // pages moved per refill/drain
+#define KMEM_HIGH    (2*KMEM_BATCH) // drain a CPU list above this
+#define KZERO_TARGET 64             // pre-zeroed pages to keep
+
+#define NPAGES       ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2IDX(pa)   (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define IDX2PA(i)    (KERNBASE + (uint64)(i) * PGSIZE)
+
+// pageinfo[] marks the first page of each free buddy block.
+#define PG_FREE      0x80           // | order
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -16,50 +53,233 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;                 // only used on buddy lists
 };
 
+// the buddy allocator. free[k] is a circular list
+// of free blocks of 2^k pages.
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1];
+  uchar pageinfo[NPAGES];
+  int nfree;                        // free pages, all orders
 } kmem;
 
+// per-CPU free lists of single pages. c->lock is only
+// contended when another CPU steals from this list.
+struct kmem_cpu {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  struct kmemstat st;
+} kmem_cpus[NCPU];
+
+// pages already zeroed, for kalloc_zeroed().
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} kzero;
+
+// references to each kalloc()ed page; updated with
+// atomic instructions rather than under a lock.
+int pageref[NPAGES];
+
+static void buddy_free(uint64 pa, int order);
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int k = 0; k <= MAXORDER; k++)
+    kmem.free[k].next = kmem.free[k].prev = &kmem.free[k];
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem_cpus[i].lock, "kmem_cpu");
+  initlock(&kzero.lock, "kzero");
   freerange(end, (void*)PHYSTOP);
 }
 
+// Hand a range of memory to the buddy allocator,
+// one page at a time; buddy_free() coalesces them
+// into the largest aligned blocks that fit.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
+  acquire(&kmem.lock);
   for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+    buddy_free((uint64)p, 0);
+  release(&kmem.lock);
+}
+
+static void
+list_push(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void
+list_remove(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+// Take a block of 2^order pages off the buddy lists,
+// splitting a larger block if there is none that size.
+// Caller must hold kmem.lock. Returns 0 if none.
+static uint64
+buddy_alloc(int order)
+{
+  struct run *r;
+  uint64 i;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.free[k].next != &kmem.free[k])
+      break;
+  if(k > MAXORDER)
+    return 0;
+
+  r = kmem.free[k].next;
+  list_remove(r);
+  i = PA2IDX(r);
+  kmem.pageinfo[i] = 0;
+
+  // return the unused upper halves to the lists.
+  while(k > order){
+    k--;
+    kmem.pageinfo[i + (1L << k)] = PG_FREE | k;
+    list_push(&kmem.free[k], (struct run*)IDX2PA(i + (1L << k)));
+  }
+
+  kmem.nfree -= 1 << order;
+  return (uint64)r;
+}
+
+// Return a block of 2^order pages to the buddy lists,
+// merging it with its buddy for as long as the buddy
+// is free too. Caller must hold kmem.lock.
+static void
+buddy_free(uint64 pa, int order)
+{
+  uint64 i, b;
+
+  kmem.nfree += 1 << order;
+  i = PA2IDX(pa);
+  while(order < MAXORDER){
+    b = i ^ (1L << order);
+    if(b >= NPAGES || kmem.pageinfo[b] != (PG_FREE | order))
+      break;
+    list_remove((struct run*)IDX2PA(b));
+    kmem.pageinfo[b] = 0;
+    i &= ~(1L << order);
+    order++;
+  }
+  kmem.pageinfo[i] = PG_FREE | order;
+  list_push(&kmem.free[order], (struct run*)IDX2PA(i));
+}
+
+// Move up to n pages from the front of *from to the front of *to.
+// Returns the number of pages moved.
+static int
+movepages(struct run **from, struct run **to, int n)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < n && *from; i++){
+    r = *from;
+    *from = r->next;
+    r->next = *to;
+    *to = r;
+  }
+  return i;
+}
+
+// Hand back n pages from the front of c's list to
+// the buddy allocator. Caller must hold c->lock.
+static void
+drain(struct kmem_cpu *c, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  for(; n > 0 && c->freelist; n--){
+    r = c->freelist;
+    c->freelist = r->next;
+    c->nfree--;
+    buddy_free((uint64)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Take half of some other CPU's free list.
+// Called without holding any kmem lock;
+// returns the stolen pages as a list.
+static struct run*
+steal(int self, int *n)
+{
+  struct kmem_cpu *v;
+  struct run *got = 0;
+
+  *n = 0;
+  for(int i = 1; i < NCPU && *n == 0; i++){
+    v = &kmem_cpus[(self + i) % NCPU];
+    acquire(&v->lock);
+    if(v->nfree > 0){
+      *n = movepages(&v->freelist, &got, (v->nfree + 1) / 2);
+      v->nfree -= *n;
+    }
+    release(&v->lock);
+  }
+  return got;
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kmem_cpu *c;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // a shared page is freed by its last user.
+  if((n = __sync_sub_and_fetch(&pageref[PA2IDX(pa)], 1)) > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+
+#ifdef KPOISON
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  c = &kmem_cpus[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  c->nfree++;
+  c->st.frees++;
+  if(c->nfree > KMEM_HIGH){
+    // give a batch back so it can coalesce.
+    drain(c, KMEM_BATCH);
+    c->st.drains++;
+  }
+  release(&c->lock);
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -68,15 +288,227 @@ kfree(void *pa)
 void *
 kalloc(void)
 {
-  struct run *r;
+  struct run *r, *stolen;
+  struct kmem_cpu *c;
+  uint64 pa;
+  int id, n;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  c = &kmem_cpus[id];
+
+  acquire(&c->lock);
+  if(c->freelist){
+    c->st.hits++;
+  } else {
+    acquire(&kmem.lock);
+    for(n = 0; n < KMEM_BATCH && (pa = buddy_alloc(0)) != 0; n++){
+      r = (struct run*)pa;
+      r->next = c->freelist;
+      c->freelist = r;
+    }
+    release(&kmem.lock);
+    c->nfree += n;
+    if(n > 0)
+      c->st.refills++;
+  }
 
+  if(c->freelist == 0){
+    // buddy allocator is dry too; don't hold our
+    // own lock while taking another CPU's.
+    release(&c->lock);
+    stolen = steal(id, &n);
+    acquire(&c->lock);
+    if(n > 0){
+      c->st.steals++;
+      movepages(&stolen, &c->freelist, n);
+      c->nfree += n;
+    }
+  }
+
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->nfree--;
+  }
+  release(&c->lock);
+  pop_off();
+
+  if(r == 0){
+    // last resort: the pre-zeroed pool.
+    acquire(&kzero.lock);
+    if((r = kzero.list) != 0){
+      kzero.list = r->next;
+      kzero.n--;
+    }
+    release(&kzero.lock);
+  }
+
+  if(r)
+    pageref[PA2IDX(r)] = 1;
+#ifdef KPOISON
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Add a reference to a page returned by kalloc();
+// it takes one more kfree() to free it.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  __sync_fetch_and_add(&pageref[PA2IDX(pa)], 1);
+}
+
+// Number of references to a page returned by kalloc().
+int
+krefs(void *pa)
+{
+  return __atomic_load_n(&pageref[PA2IDX(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Allocate one page filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  if((r = kzero.list) != 0){
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+
+  if(r){
+    r->next = 0;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Zero one page for the kalloc_zeroed() pool, if it is
+// below KZERO_TARGET. Called by idle CPUs from scheduler(),
+// so the zeroing stays off the fork/sbrk path.
+// Returns 1 if it added a page.
+int
+kzero_fill(void)
+{
+  struct run *r;
+
+  if(kzero.n >= KZERO_TARGET)   // racy peek; fine for a hint
+    return 0;
+  if((r = kalloc()) == 0)
+    return 0;
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if(kzero.n >= KZERO_TARGET){
+    release(&kzero.lock);
+    kfree(r);
+    return 0;
+  }
+  r->next = kzero.list;
+  kzero.list = r;
+  kzero.n++;
+  release(&kzero.lock);
+  return 1;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. kalloc_pages(0) is equivalent to kalloc().
+// Returns 0 if no block that large is free.
+void *
+kalloc_pages(int order)
+{
+  uint64 pa;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_pages: order");
+  if(order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  pa = buddy_alloc(order);
+  release(&kmem.lock);
+
+  if(pa == 0){
+    // pages cached on the per-CPU lists may be
+    // keeping buddies apart; return them and retry.
+    for(int i = 0; i < NCPU; i++){
+      acquire(&kmem_cpus[i].lock);
+      drain(&kmem_cpus[i], kmem_cpus[i].nfree);
+      release(&kmem_cpus[i].lock);
+    }
+    acquire(&kmem.lock);
+    pa = buddy_alloc(order);
+    release(&kmem.lock);
+  }
+
+#ifdef KPOISON
+  if(pa)
+    memset((char*)pa, 5, PGSIZE << order); // fill with junk
+#endif
+  return (void*)pa;
+}
+
+// Give each page of a block from kalloc_pages(order)
+// its own reference count, so that the pages can
+// be freed one at a time with kfree().
+void
+ksplit(void *pa, int order)
+{
+  for(int i = 0; i < (1 << order); i++)
+    pageref[PA2IDX(pa) + i] = 1;
+}
+
+// Free a block returned by kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_pages: order");
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < end ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+#ifdef KPOISON
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddy_free((uint64)pa, order);
+  release(&kmem.lock);
+}
+
+// Copy out per-CPU allocator counters, one struct kmemstat
+// per CPU, sampled without stopping other CPUs.
+// Returns the number of pages free in the buddy allocator.
+int
+kmemstats(struct kmemstat *st)
+{
+  struct kmem_cpu *c;
+  int n;
+
+  for(int i = 0; i < NCPU; i++){
+    c = &kmem_cpus[i];
+    acquire(&c->lock);
+    st[i] = c->st;
+    st[i].nfree = c->nfree;
+    release(&c->lock);
+  }
+  acquire(&kmem.lock);
+  n = kmem.nfree;
+  release(&kmem.lock);
+  return n;
+}
@@ -0,0 +1,9 @@
+// Per-CPU page allocator counters, see kalloc.c.
+struct kmemstat {
+  uint64 hits;     // kalloc()s served straight from the CPU's list
+  uint64 refills;  // batches pulled from the global pool
+  uint64 steals;   // batches taken from another CPU's list
+  uint64 drains;   // batches pushed back to the global pool
+  uint64 frees;    // kfree()s on this CPU
+  uint64 nfree;    // pages currently on this CPU's list
+};
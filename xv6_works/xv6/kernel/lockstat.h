@@ -0,0 +1,13 @@
+// Contention counters for one class of locks, those
+// initialized with the same name, from lockstat().
+// Kept only by kernels built with LOCKSTAT.
+#define LOCKNAMESZ 16
+
+struct lockstat {
+  char name[LOCKNAMESZ];
+  int sleep;           // 1 for sleep locks
+  uint64 acquires;
+  uint64 contended;    // acquires that had to wait
+  uint64 waitcycles;   // time spent waiting, in time CSR cycles
+  uint64 maxhold;      // longest hold, in time CSR cycles
+};
@@ -60,8 +60,12 @@
 //   text
 //   original data and bss
 //   fixed-size stack
-//   expandable heap
+//   expandable heap, up to MMAPBASE
 //   ...
-//   TRAPFRAME (p->trapframe, used by the trampoline)
+//   mmap() regions, between MMAPBASE and MMAPTOP
+//   TRAPFRAME(i) (proc[i].trapframe, used by the trampoline),
+//     one page per proc slot, so threads can share a page table
 //   TRAMPOLINE (the same page as in the kernel)
-#define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define TRAPFRAME(p) (TRAMPOLINE - ((p)+1)*PGSIZE)
+#define MMAPTOP   TRAPFRAME(NPROC-1)
+#define MMAPBASE  (MAXVA / 2)
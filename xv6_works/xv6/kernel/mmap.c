@@ -0,0 +1,625 @@
+// Memory-mapped regions: mmap() and munmap().
+//
+// Each address space has up to NVMA regions, mm->vma[], placed
+// top-down between MMAPBASE and MMAPTOP. No pages are
+// mapped by mmap() itself; vmafault() fills a page on its
+// first touch, with zeros for an anonymous region or from
+// the file (through the buffer cache) for a file region.
+//
+// A MAP_PRIVATE file region gets its own copy of each page.
+// The pages of MAP_SHARED regions are kept in shpage[], one
+// per file page, and every shared mapping of that part of
+// the file, in any address space, maps the same page; fork()
+// shares them as they are rather than copy-on-write. Pages
+// that have been stored to (PTE_D) are written back to the
+// file when they are unmapped, either by munmap() or when
+// the last thread using the address space exits or calls
+// exec(). read() and write() of the file go through the
+// buffer cache, and see stores only once written back.
+//
+// mm->lock protects the slots of mm->vma[]; pages are
+// read and written back without it, since that sleeps,
+// from a copy of the region, which is then found again
+// by address under the lock before it is changed.
+//
+// Thread stacks are anonymous regions too, see stackalloc().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+
+#define NSHPAGE 256
+
+// The pages of MAP_SHARED file regions. Each holds a
+// reference to its page, and each mapping another. Each
+// also holds a reference to its inode, so that the slot in
+// itable cannot be reused for another file meanwhile.
+struct {
+  struct spinlock lock;
+  struct shpage {
+    struct inode *ip;   // 0 if the slot is free; held by idup()
+    uint off;           // page-aligned offset in the file
+    uint64 pa;
+  } page[NSHPAGE];
+} shpages;
+
+void
+mmapinit(void)
+{
+  initlock(&shpages.lock, "shpages");
+}
+
+// The shared page for offset off of ip, with a new
+// reference for the caller, or 0 if there is none.
+static uint64
+shpageget(struct inode *ip, uint off)
+{
+  struct shpage *sp;
+  uint64 pa = 0;
+
+  acquire(&shpages.lock);
+  for(sp = shpages.page; sp < &shpages.page[NSHPAGE]; sp++){
+    if(sp->ip == ip && sp->off == off){
+      pa = sp->pa;
+      kdup((void*)pa);
+      break;
+    }
+  }
+  release(&shpages.lock);
+  return pa;
+}
+
+// Make mem, just read in, the shared page for offset off
+// of ip, unless another thread got there first. Returns
+// the page to map, with a reference for the caller, or 0
+// if the table is full.
+static uint64
+shpageadd(struct inode *ip, uint off, char *mem)
+{
+  struct shpage *sp, *free = 0;
+  uint64 pa;
+
+  acquire(&shpages.lock);
+  for(sp = shpages.page; sp < &shpages.page[NSHPAGE]; sp++){
+    if(sp->ip == ip && sp->off == off){
+      pa = sp->pa;
+      kdup((void*)pa);
+      release(&shpages.lock);
+      kfree(mem);
+      return pa;
+    }
+    if(sp->ip == 0 && free == 0)
+      free = sp;
+  }
+  if(free == 0){
+    release(&shpages.lock);
+    kfree(mem);
+    return 0;
+  }
+  free->ip = idup(ip);
+  free->off = off;
+  free->pa = (uint64)mem;
+  kdup(mem);
+  release(&shpages.lock);
+  return (uint64)mem;
+}
+
+// Free the shared pages of ip that are no longer mapped
+// anywhere, after a shared region of it is unmapped.
+static void
+shpageput(struct inode *ip)
+{
+  struct shpage *sp;
+  int n = 0;
+
+  acquire(&shpages.lock);
+  for(sp = shpages.page; sp < &shpages.page[NSHPAGE]; sp++){
+    if(sp->ip == ip && krefs((void*)sp->pa) == 1){
+      kfree((void*)sp->pa);
+      sp->ip = 0;
+      n++;
+    }
+  }
+  release(&shpages.lock);
+
+  // iput() may sleep, so not under shpages.lock.
+  if(n > 0){
+    begin_op();
+    while(n-- > 0)
+      iput(ip);
+    end_op();
+  }
+}
+
+static int
+prot2perm(int prot)
+{
+  int perm = PTE_U;
+
+  if(prot & PROT_READ)
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_R|PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Find the region of mm holding va, or 0.
+// Caller must hold mm->lock.
+struct vma*
+vmafind(struct mm *mm, uint64 va)
+{
+  struct vma *v;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->start && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Whether va is in a MAP_SHARED region of mm, whose
+// pages other address spaces may map too.
+// Caller must hold mm->lock.
+int
+vmashared(struct mm *mm, uint64 va)
+{
+  struct vma *v = vmafind(mm, va);
+
+  return v != 0 && (v->flags & MAP_SHARED);
+}
+
+// The highest free range of len bytes below MMAPTOP,
+// or 0 if there is none.
+// Caller must hold mm->lock.
+static uint64
+vmaplace(struct mm *mm, uint64 len)
+{
+  struct vma *v;
+  uint64 va;
+
+  va = MMAPTOP - len;
+again:
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if(v->start && v->start < va + len && va < v->end){
+      if(v->start < MMAPBASE + len)
+        return 0;
+      va = v->start - len;
+      goto again;
+    }
+  }
+  return va;
+}
+
+// Map len bytes of f (or zeros if f is 0) starting at file
+// offset off into the current process. Takes a reference to f.
+// Returns the address of the region, or -1.
+uint64
+vmamap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct mm *mm = myproc()->mm;
+  struct vma *v, *nv = 0;
+  uint64 va;
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  if((prot & (PROT_READ|PROT_WRITE|PROT_EXEC)) == 0)
+    return -1;   // PROT_NONE; would be a non-leaf PTE
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(f == 0 && (flags & MAP_SHARED))
+    return -1;   // no shared anonymous memory
+  if(f){
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  len = PGROUNDUP(len);
+  if(len > MMAPTOP - MMAPBASE)
+    return -1;
+
+  acquirewrite(&mm->lock);
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->start == 0){
+      nv = v;
+      break;
+    }
+  if(nv == 0 || (va = vmaplace(mm, len)) == 0){
+    releasewrite(&mm->lock);
+    return -1;
+  }
+
+  nv->start = va;
+  nv->end = va + len;
+  nv->prot = prot;
+  nv->flags = flags & (MAP_SHARED|MAP_PRIVATE);
+  nv->f = f ? filedup(f) : 0;
+  nv->off = off;
+  nv->stack = 0;
+  releasewrite(&mm->lock);
+  return va;
+}
+
+// Find or make a stack region of at least size bytes for
+// a new thread: the smallest free one that is big enough,
+// or else a new anonymous region of size bytes plus the
+// guard page. A reused stack is not cleared.
+// Returns the top of the stack, or 0.
+uint64
+stackalloc(struct mm *mm, uint64 size)
+{
+  struct vma *v, *best = 0, *nv = 0;
+  uint64 va, len;
+
+  size = PGROUNDUP(size);
+  if(size == 0 || size > MMAPTOP - MMAPBASE - PGSIZE)
+    return 0;
+  len = size + PGSIZE;
+
+  acquirewrite(&mm->lock);
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if(v->start == 0){
+      if(nv == 0)
+        nv = v;
+    } else if(v->stack == STACK_FREE && v->end - v->start >= len &&
+              (best == 0 || v->end - v->start < best->end - best->start)){
+      best = v;
+    }
+  }
+  if(best){
+    best->stack = STACK_USED;
+    va = best->end;
+  } else if(nv && (va = vmaplace(mm, len)) != 0){
+    nv->start = va;
+    nv->end = va + len;
+    nv->prot = PROT_READ|PROT_WRITE;
+    nv->flags = MAP_PRIVATE;
+    nv->f = 0;
+    nv->off = 0;
+    nv->stack = STACK_USED;
+    va = nv->end;
+  } else {
+    va = 0;
+  }
+  releasewrite(&mm->lock);
+  return va;
+}
+
+// Put the stack with the given top back for reuse,
+// when its thread exits.
+void
+stackfree(struct mm *mm, uint64 top)
+{
+  struct vma *v;
+
+  acquirewrite(&mm->lock);
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->start && v->stack && v->end == top)
+      v->stack = STACK_FREE;
+  releasewrite(&mm->lock);
+}
+
+// Does mm still map va as region v did? v may be a copy
+// from before another thread changed mm->vma[].
+// Caller must hold mm->lock.
+static int
+vmasame(struct mm *mm, struct vma *v, uint64 va)
+{
+  struct vma *cur;
+
+  if((cur = vmafind(mm, va)) == 0)
+    return 0;
+  return cur->f == v->f && cur->prot == v->prot && cur->flags == v->flags &&
+         cur->off + (va - cur->start) == v->off + (va - v->start);
+}
+
+// Fill and map the page of region v of mm holding va.
+// v may be a copy; mm->lock must not be held.
+// Returns 0 on success (including if another thread
+// mapped the page first, or unmapped or changed the
+// region meanwhile, so that the access is retried),
+// -1 if memory is exhausted or the file can't be read.
+int
+vmafault(struct mm *mm, struct vma *v, uint64 va)
+{
+  struct inode *ip = 0;
+  pte_t *pte;
+  char *mem;
+  int r, locked, shared;
+  uint off;
+
+  va = PGROUNDDOWN(va);
+  if(v->stack && va == v->start)
+    return -1;    // ran off the end of a thread stack
+  off = v->off + (va - v->start);
+  shared = v->f && (v->flags & MAP_SHARED);
+  mem = shared ? (char*)shpageget(v->f->ip, off) : 0;
+  if(mem == 0){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    if(v->f){
+      // readi() stops at the end of the file;
+      // the rest of the page stays zero.
+      ip = v->f->ip;
+      locked = holdingwritesleep(&ip->lock);
+      if(!locked)
+        ilock(ip);
+      r = readi(ip, 0, (uint64)mem, off, PGSIZE);
+      if(!locked)
+        iunlock(ip);
+      if(r < 0)
+        goto bad;
+    }
+    if(shared && (mem = (char*)shpageadd(ip, off, mem)) == 0)
+      return -1;
+  }
+
+  // the page was read in without mm->lock, so
+  // v may have been unmapped meanwhile.
+  acquirewrite(&mm->lock);
+  if(!vmasame(mm, v, va)){
+    releasewrite(&mm->lock);
+    kfree(mem);
+    if(shared)
+      shpageput(v->f->ip);
+    return 0;
+  }
+  if((pte = walk(mm->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    releasewrite(&mm->lock);
+    kfree(mem);
+    return 0;
+  }
+  r = mappages(mm->pagetable, va, PGSIZE, (uint64)mem, prot2perm(v->prot));
+  releasewrite(&mm->lock);
+  if(r != 0)
+    goto bad;
+  return 0;
+
+ bad:
+  kfree(mem);
+  return -1;
+}
+
+// Write the mapped pages of v in [a, b) back to ip, its
+// file, without growing it. v is a copy; each page is
+// looked up under mm->lock, if v still maps it, and held
+// with a reference while it is written, in case another
+// thread unmaps it meanwhile.
+static void
+writeback(struct mm *mm, struct vma *v, struct inode *ip, uint64 a, uint64 b)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint64 va, pa;
+  uint off;
+  pte_t *pte;
+  int i, n;
+
+  for(va = a; va < b; va += PGSIZE){
+    // skip pages never touched, or not stored
+    // to through this mapping.
+    pa = 0;
+    acquireread(&mm->lock);
+    if(vmasame(mm, v, va) &&
+       (pte = walk(mm->pagetable, va, 0)) != 0 &&
+       (*pte & (PTE_V|PTE_D)) == (PTE_V|PTE_D)){
+      pa = PTE2PA(*pte);
+      kdup((void*)pa);
+    }
+    releaseread(&mm->lock);
+    if(pa == 0)
+      continue;
+    off = v->off + (va - v->start);
+    for(i = 0; i < PGSIZE; i += n){
+      n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      begin_op();
+      ilock(ip);
+      if(off + i >= ip->size)
+        n = 0;
+      else if(off + i + n > ip->size)
+        n = ip->size - off - i;
+      if(n > 0)
+        writei(ip, 0, pa + i, off + i, n);
+      iunlock(ip);
+      end_op();
+      if(n == 0)
+        break;
+    }
+    kfree((void*)pa);
+  }
+}
+
+// Copy region v into *c for vmatrim(), which runs without
+// mm->lock. Returns the inode of a shared file region,
+// with a reference for vmatrim() to drop, or 0.
+// Caller must hold mm->lock.
+static struct inode*
+vmacopy(struct vma *v, struct vma *c)
+{
+  *c = *v;
+  if(v->f && (v->flags & MAP_SHARED))
+    return idup(v->f->ip);
+  return 0;
+}
+
+// Unmap [a, b) of region v of mm, which must lie within
+// it, writing back shared file pages to ip. v and ip are
+// from vmacopy(). The region is found again by address,
+// and left alone if another thread has unmapped or changed
+// it meanwhile. Frees the slot if nothing is left, or
+// splits the region if the range is inside it.
+// Returns -1 if a split needs a free slot and there is none,
+// or splitting a megapage runs out of memory.
+static int
+vmatrim(struct mm *mm, struct vma *v, struct inode *ip, uint64 a, uint64 b)
+{
+  struct vma *cur, *nv = 0;
+  struct file *f = 0;
+  int r = 0;
+
+  // writing back sleeps, so it is done without mm->lock.
+  if(ip && (v->prot & PROT_WRITE))
+    writeback(mm, v, ip, a, b);
+
+  acquirewrite(&mm->lock);
+  cur = vmafind(mm, a);
+  if(cur == 0 || !vmasame(mm, v, a) || b > cur->end)
+    goto out;
+  if(a > cur->start && b < cur->end){
+    for(nv = mm->vma; nv < &mm->vma[NVMA]; nv++)
+      if(nv->start == 0)
+        break;
+    if(nv == &mm->vma[NVMA]){
+      r = -1;
+      goto out;
+    }
+  }
+
+  if(uvmunmapmm(mm, a, (b - a) / PGSIZE) != 0){
+    r = -1;
+    goto out;
+  }
+
+  if(a == cur->start && b == cur->end){
+    f = cur->f;
+    cur->start = cur->end = 0;
+    cur->f = 0;
+  } else if(a == cur->start){
+    cur->off += b - cur->start;
+    cur->start = b;
+  } else if(b == cur->end){
+    cur->end = a;
+  } else {
+    *nv = *cur;
+    nv->off += b - cur->start;
+    nv->start = b;
+    cur->end = a;
+    if(cur->f)
+      filedup(cur->f);
+  }
+
+ out:
+  releasewrite(&mm->lock);
+  if(ip){
+    shpageput(ip);
+    begin_op();
+    iput(ip);
+    end_op();
+  }
+  if(f)
+    fileclose(f);
+  return r;
+}
+
+// Remove the mappings in [addr, addr+len) of the current
+// process, region by region from the lowest. Returns 0,
+// or -1 for a bad range or if vmatrim() fails.
+int
+vmaunmap(uint64 addr, uint64 len)
+{
+  struct mm *mm = myproc()->mm;
+  struct vma *v, *low, c;
+  struct inode *ip;
+  uint64 a, b, end;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+    return -1;
+  len = PGROUNDUP(len);
+  end = addr + len;
+
+  while(addr < end){
+    acquireread(&mm->lock);
+    low = 0;
+    for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+      if(v->start == 0 || v->end <= addr || end <= v->start)
+        continue;
+      if(low == 0 || v->start < low->start)
+        low = v;
+    }
+    if(low == 0){
+      releaseread(&mm->lock);
+      break;
+    }
+    a = addr > low->start ? addr : low->start;
+    b = end < low->end ? end : low->end;
+    ip = vmacopy(low, &c);
+    releaseread(&mm->lock);
+
+    if(vmatrim(mm, &c, ip, a, b) < 0)
+      return -1;
+    addr = b;
+  }
+  return 0;
+}
+
+// Give nmm copies of mm's regions, sharing any pages
+// already faulted in: copy-on-write for private regions,
+// as they are for MAP_SHARED ones. The child has only
+// the thread whose stack tops at ustack, so the other
+// threads' stacks are free there.
+// Returns 0, or -1 if out of memory, having undone
+// what it did.
+// Caller must hold mm->lock.
+int
+vmafork(struct mm *mm, struct mm *nmm, uint64 ustack)
+{
+  struct vma *v, *nv;
+
+  for(v = mm->vma, nv = nmm->vma; v < &mm->vma[NVMA]; v++, nv++){
+    if(v->start == 0)
+      continue;
+    if(uvmshare(mm->pagetable, nmm->pagetable, v->start, v->end,
+                !(v->flags & MAP_SHARED)) < 0)
+      goto bad;
+    *nv = *v;
+    if(nv->f)
+      filedup(nv->f);
+    if(nv->stack && nv->end != ustack)
+      nv->stack = STACK_FREE;
+  }
+  return 0;
+
+ bad:
+  // mm still holds the files, so fileclose() won't sleep.
+  for(nv = nmm->vma; nv < &nmm->vma[NVMA]; nv++){
+    if(nv->start == 0)
+      continue;
+    uvmunmap(nmm->pagetable, nv->start, (nv->end - nv->start) / PGSIZE, 1);
+    if(nv->f)
+      fileclose(nv->f);
+    nv->start = nv->end = 0;
+    nv->f = 0;
+  }
+  return -1;
+}
+
+// Unmap all of mm's regions, when it is freed.
+void
+vmafree(struct mm *mm)
+{
+  struct vma *v, c;
+  struct inode *ip;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    acquireread(&mm->lock);
+    if(v->start == 0){
+      releaseread(&mm->lock);
+      continue;
+    }
+    ip = vmacopy(v, &c);
+    releaseread(&mm->lock);
+    vmatrim(mm, &c, ip, c.start, c.end);
+  }
+}
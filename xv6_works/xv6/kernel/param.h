@@ -1,13 +1,29 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // unreferenced in-memory i-nodes kept for reuse
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NSEG          4  // demand-paged ELF segments per process
+#define NVMA         16  // mmap() regions per process
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // disk block cache size; grows past this only when all are in use
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // largest kalloc_pages() block is 2^MAXORDER pages
+#define TIMEFREQ     10000000 // time CSR cycles per second in qemu
+#define TICKCYCLES   (TIMEFREQ/10)  // time CSR cycles per tick
+#if defined(MLFQ) && defined(STRIDE)
+#error "MLFQ and STRIDE are different schedulers; build with one"
+#endif
+#define NTICKETS      100  // default tickets for the stride scheduler
+#define STRIDE1       (1 << 20)  // stride of a process with one ticket
+#ifdef MLFQ
+#define NPRIO         3    // scheduler priority levels
+#define QUANTUM(l)    (1 << (l))  // timer ticks per time slice at level l
+#define BOOSTTICKS    50   // ticks between priority boosts
+#else
+#define NPRIO         1    // round robin, or ordered by pass for STRIDE
+#endif
@@ -17,8 +17,17 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int reading;    // a reader is copying out bytes not yet taken
 };
 
+struct kmem_cache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +37,13 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->reading = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +57,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,63 +78,95 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// copyin() and copyout() may have to read a program or
+// mmap()ed page from disk, which sleeps, so they are not
+// called with pi->lock held: the bytes go through buf.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, j, m;
   struct proc *pr = myproc();
+  char buf[PIPESIZE];
 
-  acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
-      release(&pi->lock);
-      return -1;
-    }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(copyin(pr->mm->pagetable, buf, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for(j = 0; j < m; ){
+      if(pi->readopen == 0 || killed(pr)){
+        // pass on a wakeup this writer may have been given.
+        wakeone(&pi->nwrite);
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        wakeone(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+      } else
+        pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
     }
+    wakeone(&pi->nread);
+    if(pi->nwrite < pi->nread + PIPESIZE)
+      wakeone(&pi->nwrite);   // room for another writer
+    release(&pi->lock);
+    i += m;
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
 
+// The bytes are taken from the pipe only once copyout()
+// has succeeded, so a bad addr leaves them for the next
+// read. Meanwhile pi->reading keeps other readers off.
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, r;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPESIZE];
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->reading){  //DOC: pipe-empty
     if(killed(pr)){
+      // pass on a wakeup this reader may have been given.
+      wakeone(&pi->nread);
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && i < sizeof(buf); i++){  //DOC: piperead-copy
+    if(pi->nread + i == pi->nwrite)
       break;
+    buf[i] = pi->data[(pi->nread + i) % PIPESIZE];
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(i == 0){
+    // end of file, for any other reader too.
+    wakeone(&pi->nread);
+    release(&pi->lock);
+    return 0;
+  }
+  pi->reading = 1;
   release(&pi->lock);
-  return i;
+
+  r = copyout(pr->mm->pagetable, addr, buf, i);
+
+  acquire(&pi->lock);
+  pi->reading = 0;
+  if(r == 0){
+    pi->nread += i;
+    wakeone(&pi->nwrite);  //DOC: piperead-wakeup
+  }
+  if(pi->nread < pi->nwrite || pi->writeopen == 0)
+    wakeone(&pi->nread);   // more for another reader
+  release(&pi->lock);
+  return r == 0 ? i : -1;
 }
@@ -5,6 +5,9 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "slab.h"
+#include "sched.h"
+#include "tls.h"
 
 struct cpu cpus[NCPU];
 
@@ -15,8 +18,49 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+static struct kmem_cache *mmcache;
+
+// Per-CPU queues of RUNNABLE processes. A process is on
+// exactly one queue while it is RUNNABLE, normally that of
+// the CPU it last ran on; idle CPUs steal from the longest.
+// Each has a list per priority level (just one unless built
+// with MLFQ), and the scheduler runs the highest non-empty.
+// Built with STRIDE, the one list is kept in order of pass.
+// Lock order: p->lock, then rq->lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;
+  uint boost;             // last priority boost, see rqpop()
+  uint64 pass;            // pass of the last process taken
+} runq[NCPU];
+
+uint onlinecpus;          // CPUs that have reached scheduler()
+
+// Processes in sleep(), hashed by channel, so that
+// wakeup() looks only at those that may be on its
+// channel. A private futex's channel is a user address,
+// qualified by its mm; others have mm 0. Lock order: lk
+// passed to sleep(), or mm->lock in futex_wait(), then
+// wq->lock, then p->lock. cond_wait() holds two wq->locks,
+// and takes them in address order.
+#define NWAITQ 64
+#define WQHASH(chan, mm) \
+  (((((uint64)(chan)) ^ (uint64)(mm)) * 0x9E3779B97F4A7C15ULL) >> 58)
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;      // linked by p->wqnext, oldest first
+} waitq[NWAITQ];
+
 extern void forkret(void);
+static void wqsleep(struct waitq *wq, void *chan, struct mm *chanmm);
+static int wqwake(struct waitq *wq, void *chan, struct mm *chanmm, int n);
+static int wake(void *chan, struct mm *chanmm, int n);
 static void freeproc(struct proc *p);
+static void setclass(struct proc *p, int class);
+static void setshare(struct proc *p, int tickets);
 
 extern char trampoline[]; // trampoline.S
 
@@ -51,10 +95,16 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  mmcache = kmem_cache_create("mm", sizeof(struct mm));
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
+      p->trapva = TRAPFRAME((int) (p - proc));
   }
 }
 
@@ -124,22 +174,21 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
-
-  // Allocate a trapframe page.
+  p->cpu = cpuid();   // start on the creator's run queue
+  setclass(p, SCHED_NORMAL);
+  setshare(p, NTICKETS);
+  p->affinity = (1 << NCPU) - 1;   // any CPU, as they come up
+  p->pass = 0;
+  p->rticks = 0;
+
+  // Allocate a trapframe page. The caller
+  // gives p an address space to map it in.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -149,8 +198,9 @@ found:
   return p;
 }
 
-// free a proc structure and the data hanging from it,
-// including user pages.
+// free a proc structure and the data hanging from it.
+// p's address space must already be released,
+// by mmdetach().
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
@@ -158,14 +208,13 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
+  p->mm = 0;
+  p->ustack = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
+  p->chanmm = 0;
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
@@ -193,9 +242,9 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe page just below the trampoline page, for
+  // map p's trapframe page below the trampoline page, for
   // trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
+  if(mappages(pagetable, p->trapva, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
@@ -211,10 +260,72 @@ void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, MMAPTOP, NPROC, 0);   // any trapframes
   uvmfree(pagetable, sz);
 }
 
+// Make an address space holding only the trampoline
+// and p's trapframe, with one reference.
+// Returns 0 if out of memory.
+struct mm*
+mmcreate(struct proc *p)
+{
+  struct mm *mm;
+
+  if((mm = kmem_cache_alloc(mmcache)) == 0)
+    return 0;
+  memset(mm, 0, sizeof(*mm));
+  if((mm->pagetable = proc_pagetable(p)) == 0){
+    kmem_cache_free(mmcache, mm);
+    return 0;
+  }
+  initrwlock(&mm->lock, "mm");
+  mm->ref = 1;
+  return mm;
+}
+
+// Drop a reference to mm. The last one unmaps its
+// mmap() regions, drops its program segments and
+// frees its memory and page table.
+// Must not be called holding a lock or inside
+// a transaction.
+void
+mmput(struct mm *mm)
+{
+  int ref;
+
+  acquirewrite(&mm->lock);
+  ref = --mm->ref;
+  releasewrite(&mm->lock);
+  if(ref > 0)
+    return;
+
+  vmafree(mm);
+  begin_op();
+  segput(mm->seg);
+  end_op();
+  proc_freepagetable(mm->pagetable, mm->sz);
+  kmem_cache_free(mmcache, mm);
+}
+
+// Unmap p's trapframe from its address space, which
+// other threads may go on using, give back p's stack
+// if the kernel made it, and drop p's reference.
+void
+mmdetach(struct proc *p)
+{
+  struct mm *mm = p->mm;
+
+  acquirewrite(&mm->lock);
+  uvmunmap(mm->pagetable, p->trapva, 1, 0);
+  releasewrite(&mm->lock);
+  if(p->ustack)
+    stackfree(mm, p->ustack);
+  p->ustack = 0;
+  p->mm = 0;
+  mmput(mm);
+}
+
 // a user program that calls exec("/init")
 // assembled from ../user/initcode.S
 // od -t xC ../user/initcode
@@ -236,11 +347,13 @@ userinit(void)
 
   p = allocproc();
   initproc = p;
+  if((p->mm = mmcreate(p)) == 0)
+    panic("userinit: mmcreate");
   
   // allocate one user page and copy initcode's instructions
   // and data into it.
-  uvmfirst(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  uvmfirst(p->mm->pagetable, initcode, sizeof(initcode));
+  p->mm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -249,29 +362,47 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Growing only moves mm->sz; pages are allocated
+// by uvmlazy() when first touched, so this costs
+// the same however many threads share the memory.
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint64 sz;
-  struct proc *p = myproc();
+  uint64 sz, oldsz;
+  struct mm *mm = myproc()->mm;
+  struct seg *s;
 
-  sz = p->sz;
+  acquirewrite(&mm->lock);
+  sz = oldsz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n >= MMAPBASE){
+      releasewrite(&mm->lock);
       return -1;
     }
-  } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    sz += n;
+  } else if(n < 0 && sz + n < sz){
+    sz += n;
+    if(PGROUNDUP(sz) < PGROUNDUP(oldsz) &&
+       uvmunmapmm(mm, PGROUNDUP(sz), (PGROUNDUP(oldsz) - PGROUNDUP(sz)) / PGSIZE) != 0){
+      releasewrite(&mm->lock);
+      return -1;
+    }
+    // freed program pages must not be paged back in
+    // from the file if the process grows again.
+    for(s = mm->seg; s < &mm->seg[NSEG]; s++)
+      if(s->ip && s->va + s->memsz > PGROUNDUP(sz))
+        s->memsz = PGROUNDUP(sz) > s->va ? PGROUNDUP(sz) - s->va : 0;
   }
-  p->sz = sz;
-  return 0;
+  mm->sz = sz;
+  releasewrite(&mm->lock);
+  return oldsz;
 }
 
 // Create a new process, copying the parent.
@@ -282,19 +413,46 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct mm *mm;
+
+  // fault in the TLS block, which may sleep, so that the
+  // child's copy is present for the tid copyout below.
+  if(p->trapframe->tp)
+    uvmfault(p, p->trapframe->tp, 0);
 
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
+  if((mm = mmcreate(np)) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. Other threads
+  // may be faulting pages into the parent meanwhile.
+  acquirewrite(&p->mm->lock);
+  mm->sz = p->mm->sz;
+  if(uvmcopy(p->mm->pagetable, mm->pagetable, mm->sz) < 0 ||
+     vmafork(p->mm, mm, p->ustack) < 0){
+    releasewrite(&p->mm->lock);
     freeproc(np);
     release(&np->lock);
+    mmput(mm);
     return -1;
   }
-  np->sz = p->sz;
+  for(i = 0; i < NSEG; i++)
+    if(p->mm->seg[i].ip){
+      mm->seg[i] = p->mm->seg[i];
+      idup(p->mm->seg[i].ip);
+    }
+  // other threads must not go on storing to
+  // pages that are now copy-on-write.
+  tlbshootdown(p->mm);
+  releasewrite(&p->mm->lock);
+  np->mm = mm;
+  np->ustack = p->ustack;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -309,17 +467,28 @@ fork(void)
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
+  setclass(np, p->sclass);
+  setshare(np, p->tickets);
+  np->affinity = p->affinity;
 
   pid = np->pid;
 
   release(&np->lock);
 
+  // the child's copy of the TLS block gets its own tid.
+  // copyout() may copy a copy-on-write page, so not under
+  // np->lock. if it cannot, kill the child rather than
+  // fail the fork, as create_thread() does.
+  if(np->trapframe->tp &&
+     copyout(mm->pagetable, np->trapframe->tp, (char *)&pid, sizeof(pid)) < 0)
+    setkilled(np);
+
   acquire(&wait_lock);
   np->parent = p;
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -351,6 +520,11 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Let go of the address space; the last thread
+  // to do so unmaps mmap() regions, writing back
+  // shared ones, and frees the memory.
+  mmdetach(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -391,7 +565,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -408,15 +582,15 @@ wait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = pp->xstate;
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
+          // not under the locks: copyout() may sleep
+          // to load the page.
+          if(addr != 0 && copyout(p->mm->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&pp->lock);
@@ -434,10 +608,679 @@ wait(uint64 addr)
   }
 }
 
+// Create a thread: a process sharing the caller's address
+// space and copies of its open files, which starts in
+// fcn(arg) with a fake return address. If size is 0 it
+// runs on the one-page user stack at stack; otherwise
+// on a stack of size bytes, with a guard page below,
+// from stackalloc(). Only the trapframe is new, so
+// this costs the same however big the process is.
+// The thread's TLS block goes at the top of its stack.
+// Returns the thread's pid, or -1.
+int
+create_thread(uint64 fcn, uint64 arg, uint64 stack, uint64 size)
+{
+  int i, tid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  uint64 top = 0, tp;
+  struct tls tls;
+
+  if(size && (top = stackalloc(mm, size)) == 0)
+    return -1;
+  if((np = allocproc()) == 0){
+    if(top)
+      stackfree(mm, top);
+    return -1;
+  }
+
+  acquirewrite(&mm->lock);
+  if(mappages(mm->pagetable, np->trapva, PGSIZE,
+              (uint64)(np->trapframe), PTE_R | PTE_W) < 0){
+    releasewrite(&mm->lock);
+    freeproc(np);
+    release(&np->lock);
+    if(top)
+      stackfree(mm, top);
+    return -1;
+  }
+  mm->ref++;
+  releasewrite(&mm->lock);
+  np->mm = mm;
+  np->ustack = top;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fcn;
+  if(top == 0)
+    top = stack + PGSIZE;
+  tp = (top - sizeof(tls)) & ~15;  // riscv sp must be 16-byte aligned
+  np->trapframe->sp = tp;
+  np->trapframe->tp = tp;
+  np->trapframe->a0 = arg;
+  np->trapframe->ra = 0xffffffff;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  setclass(np, p->sclass);
+  setshare(np, p->tickets);
+  np->affinity = p->affinity;
+
+  tid = np->pid;
+
+  release(&np->lock);
+
+  // copyout() may fault the stack page in, so not under
+  // np->lock. if the stack is bad, the thread would fault
+  // as soon as it ran anyway.
+  memset(&tls, 0, sizeof(tls));
+  tls.tid = tid;
+  if(copyout(mm->pagetable, tp, (char *)&tls, sizeof(tls)) < 0)
+    setkilled(np);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return tid;
+}
+
+// Wait for the child with pid tid, normally a thread,
+// to exit. Returns tid, or -1 if there is no such child.
+int
+join_thread(int tid)
+{
+  struct proc *pp;
+  int havekids;
+  struct proc *p = myproc();
+
+  acquire(&wait_lock);
+
+  for(;;){
+    havekids = 0;
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp->parent == p && pp->pid == tid){
+        // make sure the child isn't still in exit() or swtch().
+        acquire(&pp->lock);
+
+        havekids = 1;
+        if(pp->state == ZOMBIE){
+          freeproc(pp);
+          release(&pp->lock);
+          release(&wait_lock);
+          return tid;
+        }
+        release(&pp->lock);
+      }
+    }
+
+    if(!havekids || killed(p)){
+      release(&wait_lock);
+      return -1;
+    }
+    
+    sleep(p, &wait_lock);  //DOC: wait-sleep
+  }
+}
+
+// Find the key that futex_wait() and futex_wake() meet
+// on for user address uaddr, into *chan and *chanmm. A word
+// in a MAP_SHARED page, which other address spaces may map
+// too, is keyed on its physical address. Any other word is
+// keyed on uaddr in mm, which stays put when fork() makes
+// the page copy-on-write and a store moves it to a new frame.
+// Caller must hold mm->lock for reading, so that
+// the page stays put.
+// Returns the word's physical address, or 0 if uaddr is
+// not a mapped and writable word of mm.
+static uint64
+futexkey(struct mm *mm, uint64 uaddr, void **chan, struct mm **chanmm)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if(uaddr % sizeof(uint) != 0 || uaddr >= MAXVA)
+    return 0;
+  if((pte = walk(mm->pagetable, uaddr, 0)) == 0 ||
+     (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    return 0;
+  // walkaddr() adds the offset of the page in a megapage.
+  pa = walkaddr(mm->pagetable, uaddr) + (uaddr & (PGSIZE - 1));
+  if(vmashared(mm, uaddr)){
+    *chan = (void*)pa;
+    *chanmm = 0;
+  } else {
+    *chan = (void*)uaddr;
+    *chanmm = mm;
+  }
+  return pa;
+}
+
+// Sleep until futex_wake() on uaddr, provided that the word
+// at uaddr still holds val. Threads sharing an address space,
+// or processes sharing a MAP_SHARED page, meet in the wait
+// queues on the key from futexkey().
+// Returns 0 once woken, or -1 if the word did not hold val,
+// uaddr is not writable memory, or p has been killed.
+int
+futex_wait(uint64 uaddr, uint val)
+{
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  struct mm *chanmm;
+  struct waitq *wq;
+  uint64 pa;
+  void *chan;
+
+  if(uvmfault(p, uaddr, 1) < 0)
+    return -1;
+  acquireread(&mm->lock);
+  if((pa = futexkey(mm, uaddr, &chan, &chanmm)) == 0){
+    releaseread(&mm->lock);
+    return -1;
+  }
+
+  // futex_wake() takes wq->lock after the store it
+  // wakes for, so checking val under the lock leaves
+  // no window for a lost wakeup.
+  wq = &waitq[WQHASH(chan, chanmm)];
+  acquire(&wq->lock);
+  if(*(volatile uint*)pa != val){
+    release(&wq->lock);
+    releaseread(&mm->lock);
+    return -1;
+  }
+  acquire(&p->lock);
+  releaseread(&mm->lock);
+  if(p->killed){
+    release(&p->lock);
+    release(&wq->lock);
+    return -1;
+  }
+  wqsleep(wq, chan, chanmm);
+  return 0;
+}
+
+// Wake up to n threads in futex_wait() or
+// cond_wait() on uaddr.
+// Returns the number woken.
+int
+futex_wake(uint64 uaddr, int n)
+{
+  struct mm *mm = myproc()->mm;
+  struct mm *chanmm;
+  uint64 pa;
+  void *chan;
+
+  acquireread(&mm->lock);
+  pa = futexkey(mm, uaddr, &chan, &chanmm);
+  releaseread(&mm->lock);
+  if(pa == 0 || n <= 0)
+    return 0;    // never faulted in, so no one waits there
+  return wake(chan, chanmm, n);
+}
+
+// Release the mutex word at umutex and sleep on the
+// condition variable word at ucv, as one step: a
+// futex_wake() on ucv by a thread that takes the mutex
+// after the release is sure to find the caller asleep.
+// The mutex word is 0 when free and 2 when there may be
+// threads in futex_wait() for it, one of which is woken.
+// Returns 0 once woken, or -1 if either address is not
+// writable memory or p has been killed.
+int
+cond_wait(uint64 ucv, uint64 umutex)
+{
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  struct mm *cvmm, *mmm;
+  struct waitq *wq, *mwq;
+  void *cv, *m;
+  uint64 mpa;
+
+  if(uvmfault(p, ucv, 1) < 0 || uvmfault(p, umutex, 1) < 0)
+    return -1;
+  acquireread(&mm->lock);
+  if(futexkey(mm, ucv, &cv, &cvmm) == 0 ||
+     (mpa = futexkey(mm, umutex, &m, &mmm)) == 0){
+    releaseread(&mm->lock);
+    return -1;
+  }
+
+  // hold cv's wait queue from before the release until
+  // p is on it. Wait queue locks are taken in address order.
+  wq = &waitq[WQHASH(cv, cvmm)];
+  mwq = &waitq[WQHASH(m, mmm)];
+  if(mwq < wq)
+    acquire(&mwq->lock);
+  acquire(&wq->lock);
+  if(mwq > wq)
+    acquire(&mwq->lock);
+  __sync_synchronize();
+  if(__sync_lock_test_and_set((uint*)mpa, 0) == 2)
+    wqwake(mwq, m, mmm, 1);
+  if(mwq != wq)
+    release(&mwq->lock);
+
+  acquire(&p->lock);
+  releaseread(&mm->lock);
+  if(p->killed){
+    release(&p->lock);
+    release(&wq->lock);
+    return -1;
+  }
+  wqsleep(wq, cv, cvmm);
+  return 0;
+}
+
+// Wake CPU id from wfi in idle() by
+// making its timer go off now.
+static void
+kick(int id)
+{
+  *(uint64*)CLINT_MTIMECMP(id) = r_time();
+}
+
+// After mappings of mm have been removed or made read-only,
+// make sure no other CPU still has them in its TLB, so that
+// freed pages can be reused. A CPU running mm in user mode
+// is kicked into the kernel; uservec flushes its TLB on the
+// way in. Caller must hold mm->lock for writing.
+void
+tlbshootdown(struct mm *mm)
+{
+  struct cpu *c;
+  uint n;
+
+  if(mm->ref <= 1)
+    return;     // no other thread can be running it
+  __sync_synchronize();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c == mycpu() || *(struct mm * volatile *)&c->umm != mm)
+      continue;
+    n = *(volatile uint*)&c->utraps;
+    kick(c - cpus);
+    while(*(struct mm * volatile *)&c->umm == mm &&
+          *(volatile uint*)&c->utraps == n)
+      ;
+  }
+}
+
+// Nothing to run: stop this CPU's periodic timer and wait
+// in wfi. rqpush() kicks an idle CPU when there is work for
+// it, and the timer is set only for the earliest deadline
+// of sys_sleep() or of this CPU's nanosleep()ers, if any.
+static void
+idle(void)
+{
+  struct cpu *c = mycpu();
+  struct runq *rq;
+  uint64 t0;
+
+  intr_off();
+  // set the timer before announcing that this CPU is
+  // idle, so that it cannot overwrite a kick.
+  timerset(tickwake ? (uint64)tickwake * TICKCYCLES : ~0ULL);
+  c->idle = 1;
+  __sync_synchronize();
+  for(rq = runq; rq < &runq[NCPU]; rq++)
+    if(rq->n > 0)
+      break;
+  if(rq == &runq[NCPU]){
+    // a pending interrupt ends wfi even though
+    // interrupts are off; it is taken below.
+    t0 = r_time();
+    asm volatile("wfi");
+    c->idlecycles += r_time() - t0;
+  }
+  c->idle = 0;
+  timerset(r_time() + TICKCYCLES);
+  intr_on();
+  clockintr();
+}
+
+// Add p to the tail of rq's list for its priority.
+static void
+rqpush(struct runq *rq, struct proc *p)
+{
+  int l = p->prio, t, i;
+
+  acquire(&rq->lock);
+#ifdef STRIDE
+  struct proc **pp;
+
+  // a process that has been asleep starts level
+  // with the others rather than with banked credit.
+  if(p->pass < rq->pass)
+    p->pass = rq->pass;
+  for(pp = &rq->head[l]; *pp && (*pp)->pass <= p->pass; pp = &(*pp)->rqnext)
+    ;
+  p->rqnext = *pp;
+  *pp = p;
+  if(p->rqnext == 0)
+    rq->tail[l] = p;
+#else
+  p->rqnext = 0;
+  if(rq->tail[l])
+    rq->tail[l]->rqnext = p;
+  else
+    rq->head[l] = p;
+  rq->tail[l] = p;
+#endif
+  rq->n++;
+  release(&rq->lock);
+
+  // wake a CPU to run p: the one whose queue it is on,
+  // if that is idle, or else any idle one, to steal it,
+  // unless p is just yielding its own CPU.
+  __sync_synchronize();
+  t = rq - runq;
+  if(cpus[t].idle){
+    kick(t);
+  } else if(cpus[t].proc != p){
+    for(i = 0; i < NCPU; i++)
+      if(cpus[i].idle){
+        kick(i);
+        break;
+      }
+  }
+}
+
+// Take the first process of the highest priority in rq
+// that may run on CPU id, or 0 if there is none.
+static struct proc*
+rqpop(struct runq *rq, int id)
+{
+  struct proc *p = 0, *prev;
+  int l;
+
+  acquire(&rq->lock);
+#ifdef MLFQ
+  // every BOOSTTICKS, move everything waiting to the top
+  // list so that nothing starves; the scheduler resets
+  // each process's own priority as it runs it.
+  if(rq->boost != ticks / BOOSTTICKS){
+    rq->boost = ticks / BOOSTTICKS;
+    for(l = 1; l < NPRIO; l++){
+      if(rq->head[l] == 0)
+        continue;
+      if(rq->tail[0])
+        rq->tail[0]->rqnext = rq->head[l];
+      else
+        rq->head[0] = rq->head[l];
+      rq->tail[0] = rq->tail[l];
+      rq->head[l] = rq->tail[l] = 0;
+    }
+  }
+#endif
+  for(l = 0; l < NPRIO; l++){
+    // p->affinity is read without p->lock;
+    // the scheduler checks it again.
+    prev = 0;
+    for(p = rq->head[l]; p; prev = p, p = p->rqnext)
+      if(p->affinity & (1 << id))
+        break;
+    if(p){
+      if(prev)
+        prev->rqnext = p->rqnext;
+      else
+        rq->head[l] = p->rqnext;
+      if(rq->tail[l] == p)
+        rq->tail[l] = prev;
+      rq->n--;
+      rq->pass = p->pass;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Take a process from the longest run queue
+// of another CPU, or 0 if there are none.
+static struct proc*
+steal(int id)
+{
+  struct runq *rq, *max = 0;
+
+  // n is read without the locks; a stale
+  // count only makes for a worse choice.
+  for(rq = runq; rq < &runq[NCPU]; rq++)
+    if(rq != &runq[id] && rq->n > 0 && (max == 0 || rq->n > max->n))
+      max = rq;
+  if(max == 0)
+    return 0;
+  return rqpop(max, id);
+}
+
+// Put p in scheduling class class, at the
+// top priority that class allows.
+// Caller must hold p->lock.
+static void
+setclass(struct proc *p, int class)
+{
+  p->sclass = class;
+  p->prio = class == SCHED_BATCH ? NPRIO-1 : 0;
+  p->slice = 0;
+}
+
+// Give p the given number of tickets, its share
+// of the CPU under the stride scheduler.
+// Caller must hold p->lock.
+static void
+setshare(struct proc *p, int tickets)
+{
+  p->tickets = tickets;
+  p->stride = STRIDE1 / tickets;
+}
+
+// Called on each timer interrupt taken while the current
+// process runs, to charge it for the tick. Returns 1 if it
+// should give up the CPU: always under round robin and
+// stride; under MLFQ when it has used up its time slice,
+// after which it drops a level, or when something of
+// higher priority waits for this CPU.
+int
+timeslice(void)
+{
+  struct proc *p = myproc();
+  int r = 1;
+
+  acquire(&p->lock);
+  p->rticks++;
+#if defined(MLFQ)
+  if(++p->slice >= QUANTUM(p->prio)){
+    if(p->sclass == SCHED_NORMAL && p->prio < NPRIO-1)
+      p->prio++;
+    p->slice = 0;
+  } else {
+    // read without rq->lock; a stale look
+    // only puts off preemption for a tick.
+    struct runq *rq = &runq[p->cpu];
+    r = 0;
+    for(int l = 0; l < p->prio; l++)
+      if(rq->head[l])
+        r = 1;
+  }
+#elif defined(STRIDE)
+  p->pass += p->stride;
+#endif
+  release(&p->lock);
+  return r;
+}
+
+// Set the caller's tickets. Returns 0, or -1 if
+// n is out of range. Children inherit them.
+int
+settickets(int n)
+{
+  struct proc *p = myproc();
+
+  if(n < 1 || n > STRIDE1)
+    return -1;
+  acquire(&p->lock);
+  setshare(p, n);
+  release(&p->lock);
+  return 0;
+}
+
+// Return the number of timer ticks process pid,
+// or the caller if pid is 0, has run for, or -1.
+int
+getruntime(int pid)
+{
+  struct proc *p;
+  int n;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      n = p->rticks;
+      release(&p->lock);
+      return n;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Set the scheduling class of process pid,
+// or of the caller if pid is 0.
+// Returns 0, or -1 if there is no such process.
+int
+setsched(int pid, int class)
+{
+  struct proc *p;
+
+  if(class != SCHED_NORMAL && class != SCHED_INTERACTIVE &&
+     class != SCHED_BATCH)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      // a RUNNABLE p stays where it is queued until it runs.
+      setclass(p, class);
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Return the scheduling class of process pid,
+// or of the caller if pid is 0, or -1.
+int
+getsched(int pid)
+{
+  struct proc *p;
+  int class;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      class = p->sclass;
+      release(&p->lock);
+      return class;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Make p RUNNABLE and queue it on the run queue of the
+// CPU it last ran on or, if its affinity no longer allows
+// that one, of the allowed CPU with the shortest queue.
+// Caller must hold p->lock.
+void
+setrunnable(struct proc *p)
+{
+  int i;
+
+  if((p->affinity & (1 << p->cpu)) == 0){
+    p->cpu = -1;
+    for(i = 0; i < NCPU; i++)
+      if((p->affinity & (1 << i)) && (p->cpu < 0 || runq[i].n < runq[p->cpu].n))
+        p->cpu = i;
+  }
+  p->state = RUNNABLE;
+  rqpush(&runq[p->cpu], p);
+}
+
+// Restrict process pid, or the caller if pid is 0, to
+// the CPUs in mask, leaving out any that are not running.
+// Returns 0, or -1 if there is no such process or no
+// CPU is left.
+int
+setaffinity(int pid, uint mask)
+{
+  struct proc *p, *me = myproc();
+  int moved = 0;
+
+  mask &= onlinecpus;
+  if(mask == 0)
+    return -1;
+  if(pid == 0)
+    pid = me->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      // a queued or running p moves when it
+      // next goes through setrunnable().
+      p->affinity = mask;
+      moved = p == me && (mask & (1 << p->cpu)) == 0;
+      release(&p->lock);
+      if(moved)
+        yield();
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Return the affinity mask of process pid, or of the
+// caller if pid is 0, or -1. Only CPUs that are running
+// are included.
+int
+getaffinity(int pid)
+{
+  struct proc *p;
+  int mask;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      mask = p->affinity & onlinecpus;
+      release(&p->lock);
+      return mask;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process from this CPU's run queue,
+//    or steal one from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,28 +1289,54 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
+  __sync_fetch_and_or(&onlinecpus, 1 << id);
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
+    if((p = rqpop(&runq[id], id)) == 0 && (p = steal(id)) == 0){
+      // nothing to run; pre-zero a page, or wait.
+      if(kzero_fill() == 0)
+        idle();
+      continue;
+    }
+
+    // p is off the queues but still RUNNABLE; only p itself
+    // changes that state, once it runs. Its lock is still held
+    // by the CPU it last ran on until that CPU is done with
+    // p's context.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    if((p->affinity & (1 << id)) == 0){
+      // its affinity changed while it was queued.
+      setrunnable(p);
       release(&p->lock);
+      continue;
     }
+#ifdef MLFQ
+    if(p->boost != ticks / BOOSTTICKS){
+      // first run since a priority boost.
+      p->boost = ticks / BOOSTTICKS;
+      setclass(p, p->sclass);
+    }
+#endif
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -504,7 +1373,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -530,53 +1399,116 @@ forkret(void)
   usertrapret();
 }
 
+// Go to sleep on chan in chanmm, at the tail of wq, its
+// wait queue. Called with wq->lock and p->lock held;
+// returns with neither held.
+static void
+wqsleep(struct waitq *wq, void *chan, struct mm *chanmm)
+{
+  struct proc *p = myproc();
+  struct proc **pp;
+
+  p->chan = chan;
+  p->chanmm = chanmm;
+  p->state = SLEEPING;
+  for(pp = &wq->head; *pp; pp = &(*pp)->wqnext)
+    ;
+  p->wqnext = 0;
+  *pp = p;
+  release(&wq->lock);
+
+  sched();
+
+  // Tidy up.
+  p->chan = 0;
+  p->chanmm = 0;
+  release(&p->lock);
+
+  // a wakeup that finds p here skips it,
+  // now that p->chan is clear.
+  acquire(&wq->lock);
+  for(pp = &wq->head; *pp != p; pp = &(*pp)->wqnext)
+    ;
+  *pp = p->wqnext;
+  release(&wq->lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = &waitq[WQHASH(chan, 0)];
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold wq->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks wq->lock),
   // so it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
-  // Go to sleep.
-  p->chan = chan;
-  p->state = SLEEPING;
-
-  sched();
-
-  // Tidy up.
-  p->chan = 0;
+  wqsleep(wq, chan, 0);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
+// Make up to n processes sleeping on chan in chanmm in wq
+// RUNNABLE, those that have slept longest first.
+// Caller must hold wq->lock.
+// Returns the number woken.
+static int
+wqwake(struct waitq *wq, void *chan, struct mm *chanmm, int n)
+{
+  struct proc *p;
+  int woken = 0;
+
+  for(p = wq->head; p && woken < n; p = p->wqnext){
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan && p->chanmm == chanmm){
+      setrunnable(p);
+      woken++;
+    }
+    release(&p->lock);
+  }
+  return woken;
+}
+
+// Wake up to n processes sleeping on chan in chanmm.
+static int
+wake(void *chan, struct mm *chanmm, int n)
+{
+  struct waitq *wq = &waitq[WQHASH(chan, chanmm)];
+  int woken;
+
+  acquire(&wq->lock);
+  woken = wqwake(wq, chan, chanmm, n);
+  release(&wq->lock);
+  return woken;
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wake(chan, 0, NPROC);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-    }
-  }
+// Wake up one process sleeping on chan, the one
+// that has waited longest. For resources that only
+// one waiter can take; a waiter that is woken but
+// leaves without taking it must pass the wakeup on.
+// Must be called without any p->lock.
+void
+wakeone(void *chan)
+{
+  wake(chan, 0, 1);
 }
 
 // Kill the process with the given pid.
@@ -593,7 +1525,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -630,7 +1562,7 @@ either_copyout(int user_dst, uint64 dst, void *src, uint64 len)
 {
   struct proc *p = myproc();
   if(user_dst){
-    return copyout(p->pagetable, dst, src, len);
+    return copyout(p->mm->pagetable, dst, src, len);
   } else {
     memmove((char *)dst, src, len);
     return 0;
@@ -645,7 +1577,7 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 {
   struct proc *p = myproc();
   if(user_src){
-    return copyin(p->pagetable, dst, src, len);
+    return copyin(p->mm->pagetable, dst, src, len);
   } else {
     memmove(dst, (char*)src, len);
     return 0;
@@ -667,9 +1599,14 @@ procdump(void)
   [ZOMBIE]    "zombie"
   };
   struct proc *p;
+  struct cpu *c;
   char *state;
 
   printf("\n");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->nticks)
+      printf("cpu %d: %d ticks, %d ticks idle\n", (int)(c - cpus),
+             c->nticks, (int)(c->idlecycles / TICKCYCLES));
   for(p = proc; p < &proc[NPROC]; p++){
     if(p->state == UNUSED)
       continue;
@@ -678,6 +1615,7 @@ procdump(void)
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    printf(" tickets %d ran %d", p->tickets, p->rticks);
     printf("\n");
   }
 }
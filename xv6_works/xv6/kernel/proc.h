@@ -24,13 +24,21 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // Waiting in idle() for work to turn up.
+  uint nticks;                // Timer interrupts taken.
+  uint64 idlecycles;          // Time spent in idle(), in time CSR cycles.
+  struct mm *umm;             // Address space in use in user mode, or 0.
+  uint utraps;                // Traps from user mode; see tlbshootdown().
 };
 
 extern struct cpu cpus[NCPU];
 
 // per-process data for the trap handling code in trampoline.S.
-// sits in a page by itself just under the trampoline page in the
-// user page table. not specially mapped in the kernel page table.
+// sits in a page by itself under the trampoline page in the
+// user page table, at TRAPFRAME(i) for proc[i], so that threads
+// sharing a page table each have their own. sscratch holds its
+// address while in user space. not specially mapped in the
+// kernel page table.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
 // kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
@@ -79,8 +87,56 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A region of user memory set up by mmap(), see mmap.c.
+struct vma {
+  uint64 start;      // page-aligned; 0 if slot unused
+  uint64 end;
+  int prot;          // PROT_READ etc.
+  int flags;         // MAP_SHARED or MAP_PRIVATE
+  struct file *f;    // mapped file; 0 if anonymous
+  uint off;          // file offset of start
+  int stack;         // STACK_USED or STACK_FREE if a thread stack
+};
+
+// A thread stack from thread_create_attr() is a region whose
+// lowest page is a guard, never mapped. It stays in the
+// address space when its thread exits, for reuse.
+#define STACK_USED 1
+#define STACK_FREE 2
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// An ELF segment whose pages exec() left to be read in
+// from the program file on first touch, see segload().
+struct seg {
+  struct inode *ip;  // program file; 0 if slot unused
+  uint64 va;         // page-aligned start of segment
+  uint64 memsz;      // size in memory
+  uint64 filesz;     // bytes read from the file; rest is zero
+  uint off;          // file offset of va
+  int perm;          // PTE_X and/or PTE_W
+};
+
+// A user address space. The threads of a process share one,
+// each holding a reference; exec() gives the caller a new one.
+// Each thread's trapframe is mapped at its own p->trapva.
+// uservec and userret flush the TLB on every crossing between
+// user and kernel, so only a CPU running mm in user mode can
+// hold its translations: cpu->umm names that mm. After removing
+// or write-protecting mappings, tlbshootdown() kicks each such
+// CPU into the kernel and waits for its cpu->utraps to move on.
+// copyin() and copyout() hold lock for reading while they copy,
+// so threads copying at once do not wait for each other; all
+// changes take it for writing.
+struct mm {
+  struct rwspinlock lock; // protects ref, sz, seg, vma and PTE changes
+  int ref;                // procs using this address space
+  pagetable_t pagetable;  // User page table
+  uint64 sz;              // Size of process memory (bytes)
+  struct seg seg[NSEG];   // Not yet loaded program segments
+  struct vma vma[NVMA];   // mmap() regions
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -88,17 +144,37 @@ struct proc {
   // p->lock must be held when using these:
   enum procstate state;        // Process state
   void *chan;                  // If non-zero, sleeping on chan
+  struct mm *chanmm;           // With chan, key of a private futex
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue it joins
+  uint affinity;               // Mask of CPUs it may run on
+  int sclass;                  // Scheduling class, SCHED_NORMAL etc.
+  int prio;                    // Run queue level; 0 is the highest
+  int slice;                   // Timer ticks used at this level
+  uint boost;                  // Last priority boost it has had
+  int tickets;                 // CPU share under the stride scheduler
+  uint64 stride;               // STRIDE1 / tickets
+  uint64 pass;                 // Virtual time; the lowest runs next
+  uint rticks;                 // Timer ticks spent running
+
+  // the lock of the run queue, wait queue or timer
+  // queue p is on must be held when using these:
+  struct proc *rqnext;         // Next on the run queue
+  struct proc *wqnext;         // Next in chan's wait queue
+  struct timerq *tq;           // Timer queue in nanosleep(), or 0
+  struct proc *tqnext;         // Next on the timer queue
+  uint64 wakeat;               // nanosleep() deadline, in time CSR cycles
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  uint64 trapva;               // User virtual address of trapframe
+  uint64 ustack;               // Top of its stack region, or 0
+  struct mm *mm;               // User address space
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
@@ -0,0 +1,6 @@
+// Scheduling classes, for setsched(). They matter
+// only to the MLFQ scheduler (make MLFQ=1); round
+// robin treats every class the same.
+#define SCHED_NORMAL      0  // drops in priority as it uses the CPU
+#define SCHED_INTERACTIVE 1  // stays at the top priority
+#define SCHED_BATCH       2  // stays at the bottom, with the longest slices
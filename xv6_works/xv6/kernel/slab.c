@@ -0,0 +1,218 @@
+// Object caches for fixed-size kernel structures.
+//
+// A cache hands out objects of one size. Objects are carved
+// out of slabs: a block of 2^order pages from kalloc_pages()
+// with a struct slab header at its start. Since buddy blocks
+// are aligned to their size, the slab an object belongs to
+// is found by rounding the object's address down.
+//
+// Each CPU keeps a small magazine of free objects per cache,
+// so kmem_cache_alloc()/kmem_cache_free() usually only push
+// or pop a pointer with interrupts off. The cache lock is
+// taken to move half a magazine to or from the slabs.
+//
+// Interface:
+// * kmem_cache_create(name, size) makes a cache, at boot.
+// * kmem_cache_alloc(c) returns an object, or 0 if out of memory.
+// * kmem_cache_free(c, obj) gives it back.
+// Objects are not zeroed; callers initialize every field they use.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "slab.h"
+
+#define NCACHE      16
+
+struct freeobj {
+  struct freeobj *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabtable;
+
+void
+slabinit(void)
+{
+  initlock(&slabtable.lock, "slabtable");
+}
+
+// Make a cache for objects of size bytes.
+// Picks the smallest slab order that wastes
+// less than 1/8 of the slab.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+  uint avail;
+  int order;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(struct freeobj))
+    size = sizeof(struct freeobj);
+
+  for(order = 0; order < MAXORDER; order++){
+    avail = (PGSIZE << order) - sizeof(struct slab);
+    if(avail >= size && avail % size <= (PGSIZE << order) / 8)
+      break;
+  }
+  if((PGSIZE << order) - sizeof(struct slab) < size)
+    panic("kmem_cache_create: size");
+
+  acquire(&slabtable.lock);
+  if(slabtable.n >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabtable.cache[slabtable.n++];
+  release(&slabtable.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->order = order;
+  c->perslab = ((PGSIZE << order) - sizeof(struct slab)) / size;
+  c->partial.next = c->partial.prev = &c->partial;
+  c->nslabs = 0;
+  c->nempty = 0;
+  memset(c->mag, 0, sizeof(c->mag));
+  return c;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+static void
+slab_link(struct kmem_cache *c, struct slab *s)
+{
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+}
+
+// Get a fresh slab from the page allocator and
+// thread all of its objects onto its free list.
+// Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  struct freeobj *o;
+  char *p;
+  int i;
+
+  if((s = kalloc_pages(c->order)) == 0)
+    return 0;
+  s->cache = c;
+  s->free = 0;
+  s->inuse = 0;
+  p = (char*)(s + 1);
+  for(i = c->perslab - 1; i >= 0; i--){
+    o = (struct freeobj*)(p + i * c->size);
+    o->next = s->free;
+    s->free = o;
+  }
+  slab_link(c, s);
+  c->nslabs++;
+  c->nempty++;
+  return s;
+}
+
+// Take one object from the slabs.
+// Caller must hold c->lock.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  struct freeobj *o;
+
+  s = c->partial.next;
+  if(s == &c->partial && (s = slab_grow(c)) == 0)
+    return 0;
+  o = s->free;
+  s->free = o->next;
+  if(s->inuse++ == 0)
+    c->nempty--;
+  if(s->free == 0)
+    slab_unlink(s);     // full; relinked when an object comes back
+  return o;
+}
+
+// Return one object to its slab. Keeps one empty slab
+// around to absorb alloc/free churn; further empty slabs
+// go back to the page allocator.
+// Caller must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+  struct freeobj *o = obj;
+
+  s = (struct slab*)((uint64)obj & ~((uint64)(PGSIZE << c->order) - 1));
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+  if(s->free == 0)
+    slab_link(c, s);
+  o->next = s->free;
+  s->free = o;
+  if(--s->inuse == 0){
+    if(c->nempty > 0){
+      slab_unlink(s);
+      c->nslabs--;
+      kfree_pages(s, c->order);
+    } else {
+      c->nempty++;
+    }
+  }
+}
+
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    // refill half a magazine from the slabs.
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2 && (obj = slab_get(c)) != 0)
+      m->obj[m->n++] = obj;
+    release(&c->lock);
+  }
+  obj = m->n > 0 ? m->obj[--m->n] : 0;
+  pop_off();
+  return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  if(obj == 0)
+    panic("kmem_cache_free");
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    // full; return the older half to the slabs.
+    acquire(&c->lock);
+    for(int i = 0; i < MAGSIZE/2; i++)
+      slab_put(c, m->obj[i]);
+    release(&c->lock);
+    memmove(m->obj, m->obj + MAGSIZE/2, (MAGSIZE/2) * sizeof(void*));
+    m->n -= MAGSIZE/2;
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+}
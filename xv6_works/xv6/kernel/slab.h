@@ -0,0 +1,30 @@
+#define MAGSIZE     16    // objects cached per CPU per kmem_cache
+
+// per-CPU stack of free objects; only touched
+// by its own CPU, with interrupts off.
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+// header at the start of each slab.
+struct slab {
+  struct slab *next;      // cache's list of slabs with free objects
+  struct slab *prev;
+  struct kmem_cache *cache;
+  void *free;             // list of free objects in this slab
+  int inuse;              // objects handed out (incl. in magazines)
+};
+
+// Cache of equally sized objects, see slab.c.
+struct kmem_cache {
+  struct spinlock lock;   // protects the slab fields below
+  char *name;
+  uint size;              // object size, rounded up to 8 bytes
+  int order;              // each slab is 2^order pages
+  int perslab;            // objects per slab
+  struct slab partial;    // list of slabs with free objects
+  int nslabs;
+  int nempty;             // slabs with no objects in use
+  struct magazine mag[NCPU];
+};
@@ -16,17 +16,28 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+#ifdef LOCKSTAT
+  lk->class = lockclass_get(name, 1);
+#endif
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+#ifdef LOCKSTAT
+  uint64 t0 = r_time();
+  int contended = lk->locked;
+#endif
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+#ifdef LOCKSTAT
+  lk->t0 = r_time();
+  lockstat_acquire(lk->class, contended, lk->t0 - t0);
+#endif
   release(&lk->lk);
 }
 
@@ -34,9 +45,12 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+#ifdef LOCKSTAT
+  lockstat_release(lk->class, r_time() - lk->t0);
+#endif
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  wakeone(lk);    // only one waiter can have it
   release(&lk->lk);
 }
 
@@ -51,5 +65,95 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Reader-writer sleep locks.
 
+void
+initrwsleeplock(struct rwsleeplock *lk, char *name)
+{
+  initlock(&lk->lk, "sleep lock");
+  lk->name = name;
+  lk->readers = 0;
+  lk->writer = 0;
+  lk->wwait = 0;
+  lk->pid = 0;
+#ifdef LOCKSTAT
+  lk->class = lockclass_get(name, 1);
+#endif
+}
+
+// Take lk for reading, sleeping while it is
+// held or wanted for writing.
+void
+acquirereadsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+#ifdef LOCKSTAT
+  uint64 t0 = r_time();
+  int contended = lk->writer || lk->wwait;
+#endif
+  while(lk->writer || lk->wwait)
+    sleep(lk, &lk->lk);
+  lk->readers++;
+#ifdef LOCKSTAT
+  lockstat_acquire(lk->class, contended, r_time() - t0);
+#endif
+  release(&lk->lk);
+}
+
+void
+releasereadsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasereadsleep");
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Take lk for writing, sleeping until the
+// readers and any other writer let go of it.
+void
+acquirewritesleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+#ifdef LOCKSTAT
+  uint64 t0 = r_time();
+  int contended = lk->writer || lk->readers;
+#endif
+  lk->wwait++;
+  while(lk->writer || lk->readers)
+    sleep(lk, &lk->lk);
+  lk->wwait--;
+  lk->writer = 1;
+  lk->pid = myproc()->pid;
+#ifdef LOCKSTAT
+  lk->t0 = r_time();
+  lockstat_acquire(lk->class, contended, lk->t0 - t0);
+#endif
+  release(&lk->lk);
+}
 
+void
+releasewritesleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+#ifdef LOCKSTAT
+  lockstat_release(lk->class, r_time() - lk->t0);
+#endif
+  lk->writer = 0;
+  lk->pid = 0;
+  wakeup(lk);     // a writer, or all the readers
+  release(&lk->lk);
+}
+
+int
+holdingwritesleep(struct rwsleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->writer && (lk->pid == myproc()->pid);
+  release(&lk->lk);
+  return r;
+}
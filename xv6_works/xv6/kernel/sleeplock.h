@@ -6,5 +6,26 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+#ifdef LOCKSTAT
+  struct lockclass *class; // Counters shared by locks of this name.
+  uint64 t0;         // When the holder got it, for hold times.
+#endif
 };
 
+
+// Reader-writer sleep lock: any number of readers, or
+// one writer. A waiting writer holds off new readers.
+struct rwsleeplock {
+  int readers;       // Number of readers holding it.
+  uint writer;       // Is it held for writing?
+  int wwait;         // Writers waiting for it.
+  struct spinlock lk; // spinlock protecting this sleep lock
+
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding it for writing
+#ifdef LOCKSTAT
+  struct lockclass *class; // Counters shared by locks of this name.
+  uint64 t0;         // When the writer got it, for hold times.
+#endif
+};
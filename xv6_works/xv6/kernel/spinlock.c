@@ -7,13 +7,149 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+// With TICKETLOCK, a waiter that is d tickets from the
+// front waits about d*TICKETWAIT loops between looks at
+// owner, to keep the lock's cache line quiet.
+#define TICKETWAIT 32
+
+#ifdef LOCKSTAT
+// Contention counters, built with LOCKSTAT. All locks
+// initialized with the same name share a class, so that
+// e.g. the NPROC proc locks show up as one line. Counters
+// are per CPU, and only touched with interrupts off.
+#define NLOCKCLASS 64
+
+struct lockclass {
+  char *name;
+  int sleep;
+  struct {
+    uint64 acquires;
+    uint64 contended;
+    uint64 waitcycles;
+    uint64 maxhold;
+  } cpu[NCPU];
+} lockclass[NLOCKCLASS];
+
+static uint nlockclass;
+static uint classbusy;      // guards adding a class
+
+// Find or add the class for locks named name.
+// Returns 0 if the table is full; those locks
+// are not counted.
+struct lockclass*
+lockclass_get(char *name, int sleep)
+{
+  struct lockclass *c;
+
+  // lockclass_get() runs from initlock(), so it
+  // cannot use a spinlock of its own.
+  while(__sync_lock_test_and_set(&classbusy, 1) != 0)
+    ;
+  __sync_synchronize();
+  for(c = lockclass; c < &lockclass[nlockclass]; c++)
+    if(c->sleep == sleep && strncmp(c->name, name, LOCKNAMESZ) == 0)
+      goto out;
+  if(nlockclass == NLOCKCLASS){
+    c = 0;
+    goto out;
+  }
+  c = &lockclass[nlockclass++];
+  c->name = name;
+  c->sleep = sleep;
+out:
+  __sync_synchronize();
+  __sync_lock_release(&classbusy);
+  return c;
+}
+
+// Count an acquire of a lock of class c that
+// took wait cycles, or that did not have to
+// wait at all. Interrupts must be off.
+void
+lockstat_acquire(struct lockclass *c, int contended, uint64 wait)
+{
+  if(c == 0)
+    return;
+  c->cpu[cpuid()].acquires++;
+  if(contended){
+    c->cpu[cpuid()].contended++;
+    c->cpu[cpuid()].waitcycles += wait;
+  }
+}
+
+// Count a release of a lock of class c after
+// holding it for hold cycles. Interrupts must be off.
+void
+lockstat_release(struct lockclass *c, uint64 hold)
+{
+  if(c && hold > c->cpu[cpuid()].maxhold)
+    c->cpu[cpuid()].maxhold = hold;
+}
+
+// Fill in *st for the i'th lock class.
+// Returns 0, or -1 if there are not that many.
+int
+lockstat_get(int i, struct lockstat *st)
+{
+  struct lockclass *c;
+  int n;
+
+  if(i < 0 || i >= nlockclass)
+    return -1;
+  c = &lockclass[i];
+  safestrcpy(st->name, c->name, sizeof(st->name));
+  st->sleep = c->sleep;
+  st->acquires = st->contended = st->waitcycles = st->maxhold = 0;
+  for(n = 0; n < NCPU; n++){
+    st->acquires += c->cpu[n].acquires;
+    st->contended += c->cpu[n].contended;
+    st->waitcycles += c->cpu[n].waitcycles;
+    if(c->cpu[n].maxhold > st->maxhold)
+      st->maxhold = c->cpu[n].maxhold;
+  }
+  return 0;
+}
+
+// Zero all the counters. Updates that race
+// with this may survive it.
+void
+lockstat_reset(void)
+{
+  int i;
+
+  for(i = 0; i < nlockclass; i++)
+    memset(lockclass[i].cpu, 0, sizeof(lockclass[i].cpu));
+}
+
+// Take lk if it is free, without waiting.
+static int
+locktry(struct spinlock *lk)
+{
+#ifdef TICKETLOCK
+  uint t = *(volatile uint*)&lk->owner;
+  return __sync_bool_compare_and_swap(&lk->next, t, t + 1);
+#else
+  return __sync_lock_test_and_set(&lk->locked, 1) == 0;
+#endif
+}
+#endif
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
+#ifdef TICKETLOCK
+  lk->next = 0;
+  lk->owner = 0;
+#else
   lk->locked = 0;
+#endif
   lk->cpu = 0;
+#ifdef LOCKSTAT
+  lk->class = lockclass_get(name, 0);
+#endif
 }
 
 // Acquire the lock.
@@ -25,13 +161,33 @@ acquire(struct spinlock *lk)
   if(holding(lk))
     panic("acquire");
 
+#ifdef LOCKSTAT
+  uint64 t0 = r_time();
+  int contended = !locktry(lk);
+  if(!contended)
+    goto locked;
+#endif
+
+#ifdef TICKETLOCK
+  // On RISC-V, sync_fetch_and_add turns into amoadd.w.
+  uint t = __sync_fetch_and_add(&lk->next, 1);
+  uint d;
+
+  while((d = t - *(volatile uint*)&lk->owner) != 0)
+    for(volatile uint i = 0; i < d * TICKETWAIT; i++)
+      ;
+#else
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
     ;
+#endif
 
+#ifdef LOCKSTAT
+locked:
+#endif
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
   // references happen strictly after the lock is acquired.
@@ -40,6 +196,10 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+#ifdef LOCKSTAT
+  lk->t0 = r_time();
+  lockstat_acquire(lk->class, contended, lk->t0 - t0);
+#endif
 }
 
 // Release the lock.
@@ -49,6 +209,9 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  lockstat_release(lk->class, r_time() - lk->t0);
+#endif
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,6 +222,11 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#ifdef TICKETLOCK
+  // Let in the next ticket. Only the holder writes owner,
+  // so a plain load and an aligned word store will do.
+  *(volatile uint*)&lk->owner = lk->owner + 1;
+#else
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -67,6 +235,7 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#endif
 
   pop_off();
 }
@@ -77,10 +246,134 @@ int
 holding(struct spinlock *lk)
 {
   int r;
+#ifdef TICKETLOCK
+  r = (lk->next != lk->owner && lk->cpu == mycpu());
+#else
   r = (lk->locked && lk->cpu == mycpu());
+#endif
   return r;
 }
 
+// Reader-writer spin locks. Readers share the lock by
+// counting themselves into state; a writer swaps state
+// from 0 to RW_WRITER. A CPU must not take a lock for
+// reading that it already holds, since a writer waiting
+// in between would deadlock it.
+#define RW_WRITER 0x80000000
+
+void
+initrwlock(struct rwspinlock *lk, char *name)
+{
+  lk->name = name;
+  lk->state = 0;
+  lk->wwait = 0;
+  lk->cpu = 0;
+#ifdef LOCKSTAT
+  lk->class = lockclass_get(name, 0);
+#endif
+}
+
+// Count this cpu in as a reader of lk if it
+// is not held or wanted for writing.
+static int
+readtry(struct rwspinlock *lk)
+{
+  uint s = *(volatile uint*)&lk->state;
+
+  return (s & RW_WRITER) == 0 && *(volatile uint*)&lk->wwait == 0 &&
+    __sync_bool_compare_and_swap(&lk->state, s, s + 1);
+}
+
+// Take lk for reading.
+void
+acquireread(struct rwspinlock *lk)
+{
+  push_off();
+  if(holdingwrite(lk))
+    panic("acquireread");
+
+#ifdef LOCKSTAT
+  uint64 t0 = r_time();
+  int contended = !readtry(lk);
+  if(!contended)
+    goto locked;
+#endif
+  while(!readtry(lk))
+    ;
+
+#ifdef LOCKSTAT
+locked:
+#endif
+  __sync_synchronize();
+#ifdef LOCKSTAT
+  lockstat_acquire(lk->class, contended, r_time() - t0);
+#endif
+}
+
+void
+releaseread(struct rwspinlock *lk)
+{
+  if((lk->state & RW_WRITER) || lk->state == 0)
+    panic("releaseread");
+  __sync_synchronize();
+  __sync_fetch_and_sub(&lk->state, 1);
+  pop_off();
+}
+
+// Take lk for writing, once the readers
+// and any other writer have let go of it.
+void
+acquirewrite(struct rwspinlock *lk)
+{
+  push_off();
+  if(holdingwrite(lk))
+    panic("acquirewrite");
+
+#ifdef LOCKSTAT
+  uint64 t0 = r_time();
+  int contended = !__sync_bool_compare_and_swap(&lk->state, 0, RW_WRITER);
+  if(!contended)
+    goto locked;
+#endif
+  __sync_fetch_and_add(&lk->wwait, 1);
+  while(!__sync_bool_compare_and_swap(&lk->state, 0, RW_WRITER))
+    ;
+  __sync_fetch_and_sub(&lk->wwait, 1);
+
+#ifdef LOCKSTAT
+locked:
+#endif
+  __sync_synchronize();
+  lk->cpu = mycpu();
+#ifdef LOCKSTAT
+  lk->t0 = r_time();
+  lockstat_acquire(lk->class, contended, lk->t0 - t0);
+#endif
+}
+
+void
+releasewrite(struct rwspinlock *lk)
+{
+  if(!holdingwrite(lk))
+    panic("releasewrite");
+
+#ifdef LOCKSTAT
+  lockstat_release(lk->class, r_time() - lk->t0);
+#endif
+  lk->cpu = 0;
+  __sync_synchronize();
+  __sync_lock_release(&lk->state);
+  pop_off();
+}
+
+// Check whether this cpu is holding lk for writing.
+// Interrupts must be off.
+int
+holdingwrite(struct rwspinlock *lk)
+{
+  return lk->state == RW_WRITER && lk->cpu == mycpu();
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -1,9 +1,36 @@
 // Mutual exclusion lock.
+// Built with TICKETLOCK, waiters take a ticket and
+// are let in in order, each spinning on a read of
+// owner rather than on an atomic swap.
 struct spinlock {
+#ifdef TICKETLOCK
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket of the holder.
+#else
   uint locked;       // Is the lock held?
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+#ifdef LOCKSTAT
+  struct lockclass *class; // Counters shared by locks of this name.
+  uint64 t0;         // When the holder got it, for hold times.
+#endif
 };
 
+// Reader-writer spin lock: any number of readers, or
+// one writer. A waiting writer holds off new readers,
+// so that a stream of lookups cannot starve it.
+struct rwspinlock {
+  uint state;        // Number of readers, or RW_WRITER.
+  uint wwait;        // Writers waiting for it.
+
+  // For debugging:
+  char *name;        // Name of lock.
+  struct cpu *cpu;   // The cpu holding it for writing.
+#ifdef LOCKSTAT
+  struct lockclass *class; // Counters shared by locks of this name.
+  uint64 t0;         // When the writer got it, for hold times.
+#endif
+};
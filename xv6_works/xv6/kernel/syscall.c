@@ -6,15 +6,16 @@
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
+#include "syscallstat.h"
 
 // Fetch the uint64 at addr from the current process.
 int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz) // both tests needed, in case of overflow
     return -1;
-  if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
+  if(copyin(p->mm->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
   return 0;
 }
@@ -25,7 +26,7 @@ int
 fetchstr(uint64 addr, char *buf, int max)
 {
   struct proc *p = myproc();
-  if(copyinstr(p->pagetable, buf, addr, max) < 0)
+  if(copyinstr(p->mm->pagetable, buf, addr, max) < 0)
     return -1;
   return strlen(buf);
 }
@@ -101,6 +102,26 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_kmemstat(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_thread_create(void);
+extern uint64 sys_thread_join(void);
+extern uint64 sys_thread_exit(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_setsched(void);
+extern uint64 sys_getsched(void);
+extern uint64 sys_settickets(void);
+extern uint64 sys_getruntime(void);
+extern uint64 sys_sched_setaffinity(void);
+extern uint64 sys_sched_getaffinity(void);
+extern uint64 sys_history(void);
+extern uint64 sys_clock_gettime(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_cond_wait(void);
+extern uint64 sys_thread_create_attr(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,8 +147,80 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_kmemstat] sys_kmemstat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_thread_create]        sys_thread_create,
+[SYS_thread_join]          sys_thread_join,
+[SYS_thread_exit]          sys_thread_exit,
+[SYS_futex_wait]           sys_futex_wait,
+[SYS_futex_wake]           sys_futex_wake,
+[SYS_setsched] sys_setsched,
+[SYS_getsched] sys_getsched,
+[SYS_settickets] sys_settickets,
+[SYS_getruntime] sys_getruntime,
+[SYS_sched_setaffinity] sys_sched_setaffinity,
+[SYS_sched_getaffinity] sys_sched_getaffinity,
+[SYS_history] sys_history,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_lockstat] sys_lockstat,
+[SYS_cond_wait] sys_cond_wait,
+[SYS_thread_create_attr] sys_thread_create_attr,
 };
 
+static char *syscallnames[] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_kmemstat] "kmemstat",
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_thread_create]        "thread_create",
+[SYS_thread_join]          "thread_join",
+[SYS_thread_exit]          "thread_exit",
+[SYS_futex_wait]           "futex_wait",
+[SYS_futex_wake]           "futex_wake",
+[SYS_setsched] "setsched",
+[SYS_getsched] "getsched",
+[SYS_settickets] "settickets",
+[SYS_getruntime] "getruntime",
+[SYS_sched_setaffinity] "sched_setaffinity",
+[SYS_sched_getaffinity] "sched_getaffinity",
+[SYS_history] "history",
+[SYS_clock_gettime] "clock_gettime",
+[SYS_nanosleep] "nanosleep",
+[SYS_lockstat] "lockstat",
+[SYS_cond_wait] "cond_wait",
+[SYS_thread_create_attr] "thread_create_attr",
+};
+
+// Calls made and time spent in each system call, counted
+// per CPU so that syscall() takes no lock; syscallstat()
+// adds them up.
+struct {
+  uint64 count;
+  uint64 time;
+} sysstats[NCPU][NELEM(syscalls)];
+
 void
 syscall(void)
 {
@@ -138,10 +231,36 @@ syscall(void)
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
+    uint64 t0 = r_time();
     p->trapframe->a0 = syscalls[num]();
+
+    // charge it to the CPU it finished on.
+    push_off();
+    sysstats[cpuid()][num].count++;
+    sysstats[cpuid()][num].time += r_time() - t0;
+    pop_off();
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
     p->trapframe->a0 = -1;
   }
 }
+
+// Fill in *st for system call num.
+// Returns 0, or -1 if there is no such call.
+int
+syscallstat(int num, struct syscall_stat *st)
+{
+  int i;
+
+  if(num <= 0 || num >= NELEM(syscalls) || syscalls[num] == 0)
+    return -1;
+  safestrcpy(st->name, syscallnames[num], sizeof(st->name));
+  st->count = 0;
+  st->accum_time = 0;
+  for(i = 0; i < NCPU; i++){
+    st->count += sysstats[i][num].count;
+    st->accum_time += sysstats[i][num].time;
+  }
+  return 0;
+}
@@ -20,3 +20,23 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_kmemstat 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_thread_create        25
+#define SYS_thread_join          26
+#define SYS_thread_exit          27
+#define SYS_futex_wait           28
+#define SYS_futex_wake           29
+#define SYS_setsched 30
+#define SYS_getsched 31
+#define SYS_settickets 32
+#define SYS_getruntime 33
+#define SYS_sched_setaffinity 34
+#define SYS_sched_getaffinity 35
+#define SYS_history 36
+#define SYS_clock_gettime 37
+#define SYS_nanosleep 38
+#define SYS_lockstat 39
+#define SYS_cond_wait 40
+#define SYS_thread_create_attr 41
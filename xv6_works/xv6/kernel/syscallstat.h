@@ -0,0 +1,6 @@
+// Per-system-call counters, from history().
+struct syscall_stat {
+  char name[20];      // longest is "thread_create_attr"
+  uint64 count;       // calls made since boot
+  uint64 accum_time;  // time spent in them, in time CSR cycles
+};
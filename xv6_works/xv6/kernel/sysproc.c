@@ -5,6 +5,10 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "kmemstat.h"
+#include "syscallstat.h"
+#include "time.h"
+#include "lockstat.h"
 
 uint64
 sys_exit(void)
@@ -38,14 +42,10 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  uint64 addr;
   int n;
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
@@ -62,6 +62,9 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
+    // tell idle CPUs when to wake up, see idle().
+    if(tickwake == 0 || ticks0 + n < tickwake)
+      tickwake = ticks0 + n;
     sleep(&ticks, &tickslock);
   }
   release(&tickslock);
@@ -89,3 +92,232 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// copy per-CPU page allocator counters into the
+// user array of NCPU struct kmemstat.
+// returns the number of pages free in the buddy allocator.
+uint64
+sys_kmemstat(void)
+{
+  uint64 addr;
+  struct kmemstat st[NCPU];
+  int n;
+
+  argaddr(0, &addr);
+  n = kmemstats(st);
+  if(copyout(myproc()->mm->pagetable, addr, (char *)st, sizeof(st)) < 0)
+    return -1;
+  return n;
+}
+
+uint64
+sys_thread_create(void)
+{
+  uint64 fcn, arg, stack;
+
+  argaddr(0, &fcn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return create_thread(fcn, arg, stack, 0);
+}
+
+// like thread_create(), but on a new stack
+// of the given size that the kernel makes.
+uint64
+sys_thread_create_attr(void)
+{
+  uint64 fcn, arg, size;
+
+  argaddr(0, &fcn);
+  argaddr(1, &arg);
+  argaddr(2, &size);
+  if(size == 0)
+    return -1;
+  return create_thread(fcn, arg, 0, size);
+}
+
+uint64
+sys_thread_join(void)
+{
+  int tid;
+
+  argint(0, &tid);
+  return join_thread(tid);
+}
+
+uint64
+sys_thread_exit(void)
+{
+  exit(0);
+  return 0;  // not reached
+}
+
+// sleep while the word at addr holds val.
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  return futex_wait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futex_wake(addr, n);
+}
+
+// release the mutex word at m and sleep on cv.
+uint64
+sys_cond_wait(void)
+{
+  uint64 cv, m;
+
+  argaddr(0, &cv);
+  argaddr(1, &m);
+  return cond_wait(cv, m);
+}
+
+uint64
+sys_setsched(void)
+{
+  int pid, class;
+
+  argint(0, &pid);
+  argint(1, &class);
+  return setsched(pid, class);
+}
+
+uint64
+sys_getsched(void)
+{
+  int pid;
+
+  argint(0, &pid);
+  return getsched(pid);
+}
+
+uint64
+sys_settickets(void)
+{
+  int n;
+
+  argint(0, &n);
+  return settickets(n);
+}
+
+uint64
+sys_getruntime(void)
+{
+  int pid;
+
+  argint(0, &pid);
+  return getruntime(pid);
+}
+
+// mask has bit i set for each CPU i
+// the process may run on.
+uint64
+sys_sched_setaffinity(void)
+{
+  int pid, mask;
+
+  argint(0, &pid);
+  argint(1, &mask);
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_sched_getaffinity(void)
+{
+  int pid;
+
+  argint(0, &pid);
+  return getaffinity(pid);
+}
+
+uint64
+sys_history(void)
+{
+  int num;
+  uint64 addr;
+  struct syscall_stat st;
+
+  argint(0, &num);
+  argaddr(1, &addr);
+  if(syscallstat(num, &st) < 0)
+    return -1;
+  if(copyout(myproc()->mm->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// time since boot, to the resolution of the time CSR.
+uint64
+sys_clock_gettime(void)
+{
+  int clk;
+  uint64 addr, t;
+  struct timespec ts;
+
+  argint(0, &clk);
+  argaddr(1, &addr);
+  if(clk != CLOCK_MONOTONIC)
+    return -1;
+  t = r_time();
+  ts.tv_sec = t / TIMEFREQ;
+  ts.tv_nsec = (t % TIMEFREQ) * (1000000000 / TIMEFREQ);
+  if(copyout(myproc()->mm->pagetable, addr, (char *)&ts, sizeof(ts)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_nanosleep(void)
+{
+  uint64 addr;
+  struct timespec ts;
+
+  argaddr(0, &addr);
+  if(copyin(myproc()->mm->pagetable, (char *)&ts, addr, sizeof(ts)) < 0)
+    return -1;
+  if(ts.tv_nsec >= 1000000000)
+    return -1;
+  // longer would overflow the deadline in cycles.
+  if(ts.tv_sec > MAXSLEEPSEC)
+    ts.tv_sec = MAXSLEEPSEC;
+  return nanosleep(ts.tv_sec * TIMEFREQ + ts.tv_nsec / (1000000000 / TIMEFREQ));
+}
+
+// copy out the counters of up to n lock classes,
+// then zero them all if reset is set. returns
+// the number copied, or -1 without LOCKSTAT.
+uint64
+sys_lockstat(void)
+{
+#ifdef LOCKSTAT
+  uint64 addr;
+  int n, reset, i;
+  struct lockstat st;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  argint(2, &reset);
+  for(i = 0; i < n && lockstat_get(i, &st) == 0; i++)
+    if(copyout(myproc()->mm->pagetable, addr + i*sizeof(st), (char *)&st, sizeof(st)) < 0)
+      return -1;
+  if(reset)
+    lockstat_reset();
+  return i;
+#else
+  return -1;
+#endif
+}
@@ -0,0 +1,9 @@
+// For clock_gettime() and nanosleep().
+#define CLOCK_MONOTONIC 1   // time since boot, from the time CSR
+
+#define MAXSLEEPSEC (1ULL << 32)  // longest nanosleep(); longer is cut short
+
+struct timespec {
+  uint64 tv_sec;
+  uint64 tv_nsec;    // 0 to 999999999
+};
@@ -0,0 +1,111 @@
+//
+// Per-CPU timer queues, for nanosleep().
+//
+// A sleeper is queued on the CPU it calls from, in order of
+// deadline, and that CPU's CLINT timer is brought forward to
+// the first deadline, so wakeups are not rounded up to the
+// next tick. The CPU's timer interrupt wakes those that are
+// due; a killed sleeper takes itself off the queue.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct timerq {
+  struct spinlock lock;
+  struct proc *head;      // linked by p->tqnext, soonest first
+} timerq[NCPU];
+
+void
+timerqinit(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&timerq[i].lock, "timerq");
+}
+
+// Set this CPU's timer to go off at when, or at the
+// first deadline on its queue if that is sooner.
+// Interrupts must be off.
+void
+timerset(uint64 when)
+{
+  int id = cpuid();
+  struct timerq *q = &timerq[id];
+
+  acquire(&q->lock);
+  if(q->head && q->head->wakeat < when)
+    when = q->head->wakeat;
+  *(uint64*)CLINT_MTIMECMP(id) = when;
+  release(&q->lock);
+}
+
+// Called on each timer interrupt: wake the sleepers
+// on this CPU's queue that are due, and make sure
+// the timer goes off again for the next one.
+void
+timerintr(void)
+{
+  int id = cpuid();
+  struct timerq *q = &timerq[id];
+  struct proc *p;
+  uint64 now = r_time();
+
+  acquire(&q->lock);
+  while((p = q->head) != 0 && p->wakeat <= now){
+    q->head = p->tqnext;
+    p->tq = 0;
+    wakeup(&p->wakeat);
+  }
+  if(p && p->wakeat < *(uint64*)CLINT_MTIMECMP(id))
+    *(uint64*)CLINT_MTIMECMP(id) = p->wakeat;
+  release(&q->lock);
+}
+
+// Sleep for n time CSR cycles.
+// Returns 0, or -1 if killed first.
+int
+nanosleep(uint64 n)
+{
+  struct proc *p = myproc();
+  struct proc **pp;
+  struct timerq *q;
+  int id;
+
+  // the lock keeps interrupts off, so this
+  // stays the CPU whose queue is in use.
+  push_off();
+  id = cpuid();
+  q = &timerq[id];
+  acquire(&q->lock);
+  pop_off();
+
+  p->wakeat = r_time() + n;
+  p->tq = q;
+  for(pp = &q->head; *pp && (*pp)->wakeat <= p->wakeat; pp = &(*pp)->tqnext)
+    ;
+  p->tqnext = *pp;
+  *pp = p;
+  if(p->wakeat < *(uint64*)CLINT_MTIMECMP(id))
+    *(uint64*)CLINT_MTIMECMP(id) = p->wakeat;
+
+  while(p->tq){
+    if(killed(p)){
+      for(pp = &q->head; *pp != p; pp = &(*pp)->tqnext)
+        ;
+      *pp = p->tqnext;
+      p->tq = 0;
+      release(&q->lock);
+      return -1;
+    }
+    sleep(&p->wakeat, &q->lock);
+  }
+  release(&q->lock);
+  return 0;
+}
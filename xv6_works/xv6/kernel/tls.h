@@ -0,0 +1,10 @@
+// Thread-local storage. Each thread's tp register points
+// at one of these, just above its initial stack pointer;
+// exec() and create_thread() fill it in.
+#define NTLS 8
+
+struct tls {
+  int tid;              // the thread's pid, for gettid()
+  int pad;
+  uint64 slot[NTLS];    // free for the program's use
+};
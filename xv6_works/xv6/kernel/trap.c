@@ -8,6 +8,7 @@
 
 struct spinlock tickslock;
 uint ticks;
+uint tickwake;    // earliest sys_sleep() deadline, or 0; see idle()
 
 extern char trampoline[], uservec[], userret[];
 
@@ -45,6 +46,10 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // uservec has flushed the user mappings from the TLB.
+  mycpu()->umm = 0;
+  mycpu()->utraps++;
+
   struct proc *p = myproc();
   
   // save user program counter.
@@ -67,6 +72,10 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p, r_stval(), r_scause() == 15) == 0){
+    // first touch of a program or heap page, or a store
+    // to a copy-on-write page, which now has its own copy.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -76,8 +85,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is a timer interrupt
+  // and the time slice is over.
+  if(which_dev == 2 && timeslice())
     yield();
 
   usertrapret();
@@ -120,13 +130,15 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->mm->pagetable);
+  mycpu()->umm = p->mm;
+  __sync_synchronize();
 
   // jump to userret in trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // switches to the user page table, restores user registers
+  // from this thread's trapframe, and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, p->trapva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -150,8 +162,10 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt
+  // and the time slice is over.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING &&
+     timeslice())
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -160,12 +174,25 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to date from the time CSR. Every CPU that
+// is not idle calls this on its timer interrupts, and an idle
+// CPU after it wakes, so ticks can jump by more than one.
+// Sleepers are woken only once the earliest deadline passes.
 void
 clockintr()
 {
+  uint now = r_time() / TICKCYCLES;
+
+  if(now == ticks)   // racy peek; most calls stop here
+    return;
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  if(now > ticks){
+    ticks = now;
+    if(tickwake && ticks >= tickwake){
+      tickwake = 0;
+      wakeup(&ticks);
+    }
+  }
   release(&tickslock);
 }
 
@@ -205,9 +232,9 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
+    mycpu()->nticks++;
+    clockintr();
+    timerintr();
     
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,14 +17,15 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walklevel(pagetable_t, uint64, int, int *);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -33,10 +36,14 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, so that idle() can set timers
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // most of it is 2 MiB aligned, so kvmmap() uses megapages.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -82,24 +89,64 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A level-1 PTE may itself be a leaf that maps a whole
+// 2 MiB megapage; walk() then returns that PTE.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  int level = 0;
+
+  return walklevel(pagetable, va, alloc, &level);
+}
+
+// Like walk(), but stop at the PTE for *level (0 for a
+// 4 KiB page, 1 for a megapage). Sets *level to the level
+// of the PTE returned, which is higher if a megapage
+// leaf covers va.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int *level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
+}
+
+// Split the megapage leaf *pte into a page-table page
+// of 4 KiB leaves for the same memory and permissions,
+// each page with its own reference count.
+// Returns 0 on success, -1 if out of memory.
+static int
+demote(pte_t *pte)
+{
+  pagetable_t pt;
+  uint64 pa;
+  int flags;
+
+  if((pt = (pagetable_t)kalloc_zeroed()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte);
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  ksplit((void*)pa, 9);
+  *pte = PA2PTE(pt) | PTE_V;
+  return 0;
 }
 
 // Look up a virtual address, return the physical address,
@@ -110,11 +157,12 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level = 0;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
@@ -122,17 +170,38 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(level == 1)
+    pa += PGROUNDDOWN(va) & (SUPERPGSIZE - 1);
   return pa;
 }
 
-// add a mapping to the kernel page table.
+// add a mapping to the kernel page table, using
+// megapages where va and pa are both 2 MiB aligned.
 // only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  pte_t *pte;
+  uint64 n;
+  int level;
+
+  sz = PGROUNDUP(sz);
+  for(; sz > 0; va += n, pa += n, sz -= n){
+    if(va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && sz >= SUPERPGSIZE){
+      level = 1;
+      if((pte = walklevel(kpgtbl, va, 1, &level)) == 0 || level != 1)
+        panic("kvmmap");
+      if(*pte & PTE_V)
+        panic("kvmmap: remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      n = SUPERPGSIZE;
+    } else {
+      if(mappages(kpgtbl, va, PGSIZE, pa, perm) != 0)
+        panic("kvmmap");
+      n = PGSIZE;
+    }
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -164,31 +233,128 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
-// Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
-void
-uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+// Pages unmapped from an address space that other CPUs may
+// still have in their TLBs, freed only after tlbshootdown().
+#define NDEFER 32
+
+struct deferred {
+  struct mm *mm;          // 0 to free pages at once
+  int n;
+  uint64 pa[NDEFER];
+  int order[NDEFER];
+};
+
+static void
+freedeferred(struct deferred *d)
+{
+  if(d->n == 0)
+    return;
+  tlbshootdown(d->mm);
+  for(int i = 0; i < d->n; i++)
+    kfree_pages((void*)d->pa[i], d->order[i]);
+  d->n = 0;
+}
+
+static void
+freelater(struct deferred *d, uint64 pa, int order)
+{
+  if(d->mm == 0){
+    kfree_pages((void*)pa, order);
+    return;
+  }
+  if(d->n == NDEFER)
+    freedeferred(d);
+  d->pa[d->n] = pa;
+  d->order[d->n++] = order;
+}
+
+// Split the megapage holding va, if there is one and
+// va is not at its start.
+// Returns 0 on success, -1 if out of memory.
+static int
+splitat(pagetable_t pagetable, uint64 va)
 {
-  uint64 a;
   pte_t *pte;
+  int level = 0;
+
+  if(va % SUPERPGSIZE == 0 || va >= MAXVA)
+    return 0;
+  if((pte = walklevel(pagetable, va, 0, &level)) == 0 || level != 1)
+    return 0;
+  return demote(pte);
+}
+
+static int
+unmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free, struct deferred *d)
+{
+  uint64 a, end = va + npages*PGSIZE;
+  pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  // split the megapages that the range covers only in
+  // part before removing anything, so that running out
+  // of memory leaves the mappings as they were.
+  if(splitat(pagetable, va) != 0 || splitat(pagetable, end) != 0)
+    return -1;
+
+  for(a = va; a < end; a += PGSIZE){
+    level = 0;
+    if((pte = walklevel(pagetable, a, 0, &level)) == 0)
+      continue;
+    if(level == 1){
+      if(a % SUPERPGSIZE != 0 || a + SUPERPGSIZE > end)
+        panic("uvmunmap: megapage");
+      if(do_free)
+        freelater(d, PTE2PA(*pte), 9);
+      *pte = 0;
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
-    }
+    if(do_free)
+      freelater(d, PTE2PA(*pte), 0);
     *pte = 0;
   }
+  freedeferred(d);
+  return 0;
+}
+
+// Remove npages of mappings starting from va. va must be
+// page-aligned. Pages that were never touched (see
+// uvmlazy()) have no mapping and are skipped. A megapage
+// is removed whole if the range covers it, else split.
+// Optionally free the physical memory.
+// Returns 0, or -1 if splitting a megapage runs out of
+// memory, having removed nothing.
+int
+uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+{
+  struct deferred d;
+
+  d.mm = 0;
+  d.n = 0;
+  return unmap(pagetable, va, npages, do_free, &d);
+}
+
+// Remove and free npages of mm's pages starting from va,
+// as uvmunmap() does, while other threads may be using mm:
+// the pages are freed only once no CPU's TLB has them.
+// Caller must hold mm->lock for writing.
+// Returns 0, or -1 as uvmunmap() does.
+int
+uvmunmapmm(struct mm *mm, uint64 va, uint64 npages)
+{
+  struct deferred d;
+
+  d.mm = mm;
+  d.n = 0;
+  return unmap(mm->pagetable, va, npages, 1, &d);
 }
 
 // create an empty user page table.
@@ -197,10 +363,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -214,8 +379,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -233,12 +397,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -298,40 +461,288 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table but shares the physical
+// memory copy-on-write: writable pages become
+// read-only with PTE_COW in both page tables,
+// and uvmcow() copies a page on the first store.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmshare(old, new, 0, sz, 1);
+}
+
+// Share the pages of old in [start, end) with new:
+// copy-on-write, as uvmcopy() does, if cow is set, or
+// else writable by both, for MAP_SHARED regions.
+// returns 0 on success, -1 on failure.
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int cow)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  int level;
+
+  for(i = start; i < end; i += PGSIZE){
+    level = 0;
+    if((pte = walklevel(old, i, 0, &level)) == 0 || (*pte & PTE_V) == 0)
+      continue;   // not touched yet; the child faults it in too
+    if(level == 1){
+      // pages are shared one at a time.
+      if(demote(pte) != 0)
+        goto err;
+      pte = walk(old, i, 0);
+    }
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kdup((void*)pa);
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
+// Give pagetable a private, writable copy of the
+// copy-on-write page holding va, after a store to it.
+// If no one else shares the page any more it is
+// simply made writable again. If pagetable is mm's,
+// which other threads may be using, the old page is
+// let go only after tlbshootdown().
+// Returns 0 on success, -1 if va is not a
+// copy-on-write page or memory is exhausted.
+int
+uvmcow(pagetable_t pagetable, uint64 va, struct mm *mm)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefs((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  if(mm)
+    tlbshootdown(mm);
+  kfree((void*)pa);
+  return 0;
+}
+
+// Is all of [a, b) heap, with no program segment
+// or mmap() region in it?
+static int
+plainheap(struct mm *mm, uint64 a, uint64 b)
+{
+  struct seg *s;
+  struct vma *v;
+
+  for(s = mm->seg; s < &mm->seg[NSEG]; s++)
+    if(s->ip && s->va < b && a < s->va + s->memsz)
+      return 0;
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->start && v->start < b && a < v->end)
+      return 0;
+  return 1;
+}
+
+// Map a zeroed page at va on its first touch. sbrk() only
+// moves mm->sz, so heap pages below sz are allocated here,
+// from usertrap() or copyin()/copyout().
+// If the whole 2 MiB around va is plain heap below sz and
+// nothing in it is mapped yet, maps a zeroed megapage instead.
+// Returns 0 on success, -1 if va is not below sz, is
+// already mapped, or memory is exhausted.
+// Caller must hold mm->lock.
+int
+uvmlazy(struct mm *mm, uint64 va)
+{
+  pagetable_t pagetable = mm->pagetable;
+  pte_t *pte;
+  char *mem;
+  uint64 a;
+  int level;
+
+  if(va >= mm->sz || va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;    // e.g. the stack guard page
+
+  a = SUPERPGROUNDDOWN(va);
+  if(a + SUPERPGSIZE <= mm->sz && plainheap(mm, a, a + SUPERPGSIZE)){
+    level = 1;
+    pte = walklevel(pagetable, a, 1, &level);
+    if(pte && level == 1 && *pte == 0 && (mem = kalloc_pages(9)) != 0){
+      memset(mem, 0, SUPERPGSIZE);
+      *pte = PA2PTE(mem) | PTE_R|PTE_W|PTE_U|PTE_V;
+      return 0;
+    }
+  }
+
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Handle a fault by p at va, or make va accessible for
+// copyin()/copyout(); write is set for a store.
+// If the page is not present, fill it as mmap() set up
+// (vmafault()), read it from the program file if it
+// belongs to a segment that exec() left unloaded, or
+// allocate a zeroed heap page. If it is a copy-on-write
+// page and write is set, give p its own copy.
+// Other threads may fault on the same page at the same
+// time; whoever comes second finds it mapped.
+// Returns 0 on success, -1 if va is not p's memory,
+// the access is not allowed, or memory is exhausted.
+int
+uvmfault(struct proc *p, uint64 va, int write)
+{
+  struct mm *mm = p->mm;
+  struct seg *s, seg;
+  struct vma *v, vma;
+  pte_t *pte;
+  int r;
+
+  if(va >= MAXVA)
+    return -1;
+
+  acquirewrite(&mm->lock);
+  if((pte = walk(mm->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    if((*pte & PTE_U) == 0)
+      r = -1;           // e.g. the stack guard page
+    else if(write && (*pte & PTE_COW))
+      r = uvmcow(mm->pagetable, va, mm);
+    else if(write && (*pte & PTE_W) == 0)
+      r = -1;
+    else
+      r = 0;            // another thread mapped it
+    releasewrite(&mm->lock);
+    return r;
+  }
+
+  // filling mmap() and program pages may sleep,
+  // so they are read in without mm->lock.
+  if((v = vmafind(mm, va)) != 0){
+    vma = *v;
+    if(vma.f)
+      filedup(vma.f);   // in case another thread unmaps v
+    releasewrite(&mm->lock);
+    r = vmafault(mm, &vma, va);
+    if(vma.f)
+      fileclose(vma.f);
+    return r;
+  }
+  if(va >= mm->sz){
+    releasewrite(&mm->lock);
+    return -1;
+  }
+  if((s = segfind(mm->seg, va)) != 0){
+    seg = *s;           // seg.ip is held until mm is freed
+    releasewrite(&mm->lock);
+    return segload(mm, &seg, va);
+  }
+  r = uvmlazy(mm, va);
+  releasewrite(&mm->lock);
+  return r;
+}
+
+// The caller's address space, if pagetable is its page table.
+static struct mm*
+ownmm(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p && p->mm && p->mm->pagetable == pagetable)
+    return p->mm;
+  return 0;
+}
+
+// Look up a user virtual address for copyin() and friends,
+// faulting in the page, or copying it if it is copy-on-write
+// and write is set, if need be.
+// Returns the physical address, or 0. If pagetable is the
+// caller's own, returns with its mm->lock held for reading,
+// so that another thread cannot unmap the page mid-copy;
+// the caller must then call uvmaddrdone().
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int write)
+{
+  struct mm *mm = ownmm(pagetable);
+  pte_t *pte;
+  uint64 pa;
+  int level;
+
+  if(va >= MAXVA)
+    return 0;
+  if(mm == 0){
+    // exec() copies into a page table of its own,
+    // whose pages are all present.
+    if((pte = walk(pagetable, va, 0)) == 0 ||
+       (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      return 0;
+    if(write && (*pte & PTE_W) == 0 && uvmcow(pagetable, va, 0) != 0)
+      return 0;
+    return walkaddr(pagetable, va);
+  }
+
+  for(;;){
+    acquireread(&mm->lock);
+    level = 0;
+    if((pte = walklevel(pagetable, va, 0, &level)) != 0 &&
+       (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) &&
+       (!write || (*pte & PTE_W))){
+      // a store by the kernel dirties the page as
+      // one by the user would, for writeback().
+      if(write)
+        __sync_fetch_and_or(pte, PTE_D);
+      // as in walkaddr(), a heap megapage's leaf
+      // gives only the megapage's base.
+      pa = PTE2PA(*pte);
+      if(level == 1)
+        pa += PGROUNDDOWN(va) & (SUPERPGSIZE - 1);
+      return pa;
+    }
+    releaseread(&mm->lock);
+    if(uvmfault(myproc(), va, write) != 0)
+      return 0;
+  }
+}
+
+// Done with an address from uvmaddr().
+static void
+uvmaddrdone(pagetable_t pagetable)
+{
+  struct mm *mm = ownmm(pagetable);
+
+  if(mm)
+    releaseread(&mm->lock);
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -355,13 +766,14 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    uvmaddrdone(pagetable);
 
     len -= n;
     src += n;
@@ -380,13 +792,14 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    uvmaddrdone(pagetable);
 
     len -= n;
     dst += n;
@@ -407,7 +820,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -428,6 +841,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    uvmaddrdone(pagetable);
 
     srcva = va0 + PGSIZE;
   }
@@ -0,0 +1,66 @@
+// Fork latency for a process with a large heap.
+// forkbench [megabytes [iterations]]
+//
+// Grows the heap, touches every page, then times
+// fork()+exit()+wait() in two variants: a child that
+// exits at once (as sh does before exec), and one that
+// writes to every page of the heap.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+
+char *heap;
+int heapsz;
+
+int
+run(int iters, int touch)
+{
+  int i, pid, t0;
+
+  t0 = uptime();
+  for(i = 0; i < iters; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "forkbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      if(touch)
+        for(int j = 0; j < heapsz; j += PGSIZE)
+          heap[j] = j;
+      exit(0);
+    }
+    wait(0);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 16, iters = 100, t;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(argc > 2)
+    iters = atoi(argv[2]);
+
+  heapsz = mb * 1024 * 1024;
+  heap = sbrk(heapsz);
+  if(heap == (char*)-1){
+    fprintf(2, "forkbench: sbrk %d MB failed\n", mb);
+    exit(1);
+  }
+  for(int j = 0; j < heapsz; j += PGSIZE)
+    heap[j] = 1;
+
+  t = run(iters, 0);
+  printf("forkbench: %d MB heap, %d forks, child exits:  %d ticks\n", mb, iters, t);
+  t = run(iters / 10 ? iters / 10 : 1, 1);
+  printf("forkbench: %d MB heap, %d forks, child writes: %d ticks\n", mb,
+         iters / 10 ? iters / 10 : 1, t);
+  exit(0);
+}
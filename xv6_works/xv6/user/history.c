@@ -0,0 +1,41 @@
+// Print the number of calls made to each system call
+// since boot and the time spent in them.
+// history [syscall-number]
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "kernel/syscallstat.h"
+#include "user/user.h"
+
+void
+show(int num, struct syscall_stat *st)
+{
+  // TIMEFREQ/1000000 time CSR cycles to a microsecond.
+  printf("%d\t%s\t%l calls\t%l us\n", num, st->name, st->count,
+         st->accum_time / (TIMEFREQ / 1000000));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct syscall_stat st;
+  int num;
+
+  if(argc > 2){
+    fprintf(2, "usage: history [syscall-number]\n");
+    exit(1);
+  }
+  if(argc == 2){
+    num = atoi(argv[1]);
+    if(history(num, &st) < 0){
+      fprintf(2, "history: no system call %d\n", num);
+      exit(1);
+    }
+    show(num, &st);
+    exit(0);
+  }
+  for(num = 1; history(num, &st) == 0; num++)
+    show(num, &st);
+  exit(0);
+}
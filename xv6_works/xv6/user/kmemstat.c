@@ -0,0 +1,54 @@
+// Print the per-CPU page allocator counters.
+// kmemstat [command args...] runs command first and
+// reports the difference it made.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "kernel/kmemstat.h"
+#include "user/user.h"
+
+struct kmemstat before[NCPU], after[NCPU];
+
+int
+main(int argc, char *argv[])
+{
+  int i, pid, global;
+
+  if(kmemstat(before) < 0){
+    fprintf(2, "kmemstat: failed\n");
+    exit(1);
+  }
+
+  if(argc > 1){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "kmemstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      fprintf(2, "kmemstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  } else {
+    memset(before, 0, sizeof(before));
+  }
+
+  global = kmemstat(after);
+  printf("cpu\thits\trefills\tsteals\tdrains\tfrees\tnfree\n");
+  for(i = 0; i < NCPU; i++){
+    if(after[i].frees == 0 && after[i].hits == 0 && after[i].nfree == 0)
+      continue;
+    printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\n", i,
+           (int)(after[i].hits - before[i].hits),
+           (int)(after[i].refills - before[i].refills),
+           (int)(after[i].steals - before[i].steals),
+           (int)(after[i].drains - before[i].drains),
+           (int)(after[i].frees - before[i].frees),
+           (int)after[i].nfree);
+  }
+  printf("buddy allocator: %d pages free\n", global);
+  exit(0);
+}
@@ -0,0 +1,93 @@
+// Kernel spinlock contention and fairness.
+// lockbench [procs [seconds]]
+//
+// Each child is pinned to a CPU in turn and calls uptime(),
+// whose only work is taking and releasing tickslock, as fast
+// as it can. The total shows throughput under contention;
+// the spread between the busiest and the least busy child
+// shows how fair the lock is. Compare a default build with
+// one made with TICKETLOCK=1, booted with CPUS=8.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/time.h"
+#include "user/user.h"
+
+#define MAXPROCS 32
+
+void
+hammer(int cpu, int secs, int fd)
+{
+  struct timespec ts;
+  uint64 end;
+  int n = 0;
+
+  sched_setaffinity(0, 1 << cpu);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  end = ts.tv_sec + secs;
+  do {
+    for(int i = 0; i < 1000; i++)
+      uptime();
+    n += 1000;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+  } while(ts.tv_sec < end);
+  write(fd, &n, sizeof(n));
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int procs, secs = 5, ncpu, mask, cpu[NCPU], fds[2];
+  int i, n, min, max, total;
+
+  mask = sched_getaffinity(0);
+  ncpu = 0;
+  for(i = 0; i < NCPU; i++)
+    if(mask & (1 << i))
+      cpu[ncpu++] = i;
+  procs = ncpu;
+  if(argc > 1)
+    procs = atoi(argv[1]);
+  if(argc > 2)
+    secs = atoi(argv[2]);
+  if(procs < 1 || procs > MAXPROCS){
+    fprintf(2, "lockbench: 1 to %d procs\n", MAXPROCS);
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+
+  for(i = 0; i < procs; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      hammer(cpu[i % ncpu], secs, fds[1]);
+  }
+
+  total = 0;
+  min = max = -1;
+  for(i = 0; i < procs; i++){
+    if(read(fds[0], &n, sizeof(n)) != sizeof(n)){
+      fprintf(2, "lockbench: lost a child\n");
+      exit(1);
+    }
+    total += n;
+    if(min < 0 || n < min)
+      min = n;
+    if(n > max)
+      max = n;
+    wait(0);
+  }
+  printf("lockbench: %d procs on %d cpus, %d seconds\n", procs, ncpu, secs);
+  printf("  %d acquires/s\n", total / secs);
+  printf("  per proc: min %d max %d (%d%% of max)\n", min, max,
+         max ? (int)((uint64)min * 100 / max) : 0);
+  exit(0);
+}
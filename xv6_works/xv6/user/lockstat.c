@@ -0,0 +1,73 @@
+// Print kernel lock contention counters, busiest first.
+// Needs a kernel built with LOCKSTAT=1.
+// lockstat [-r]              print, then reset with -r
+// lockstat command args...   reset, run command, print
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define MAXCLASS 64
+
+struct lockstat st[MAXCLASS];
+
+void
+show(int n)
+{
+  int i, j;
+  struct lockstat t;
+
+  // most time spent waiting first.
+  for(i = 0; i < n; i++)
+    for(j = i+1; j < n; j++)
+      if(st[j].waitcycles > st[i].waitcycles){
+        t = st[i];
+        st[i] = st[j];
+        st[j] = t;
+      }
+
+  // TIMEFREQ/1000000 time CSR cycles to a microsecond.
+  printf("acquires\tcontended\twait us\tmax hold us\tname\n");
+  for(i = 0; i < n; i++){
+    if(st[i].acquires == 0)
+      continue;
+    printf("%l\t\t%l\t\t%l\t%l\t\t%s%s\n", st[i].acquires, st[i].contended,
+           st[i].waitcycles / (TIMEFREQ / 1000000),
+           st[i].maxhold / (TIMEFREQ / 1000000),
+           st[i].name, st[i].sleep ? " (sleep)" : "");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, pid, reset;
+
+  reset = argc > 1 && strcmp(argv[1], "-r") == 0;
+  if(argc > 1 && !reset){
+    if(lockstat(st, 0, 1) < 0){
+      fprintf(2, "lockstat: kernel not built with LOCKSTAT=1\n");
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+
+  if((n = lockstat(st, MAXCLASS, reset)) < 0){
+    fprintf(2, "lockstat: kernel not built with LOCKSTAT=1\n");
+    exit(1);
+  }
+  show(n);
+  exit(0);
+}
@@ -0,0 +1,220 @@
+// Locks, condition variables and semaphores for threads
+// made by thread_create(). Include once, from the program's
+// only source file.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Spin lock: busy-waits.
+struct thread_spinlock {
+  uint8 locked;       // Is the lock held?
+
+  // For debugging:
+  char *name;         // Name of lock.
+  int owner_pid;      // The thread holding the lock.
+};
+
+// Mutex: sleeps in futex_wait() while it waits.
+struct thread_mutex {
+  uint state;         // 0 free, 1 held, 2 held and waited for
+
+  // For debugging:
+  char *name;         // Name of mutex.
+  int owner_pid;      // The thread holding the mutex.
+};
+
+int holding_thread_spinlock(struct thread_spinlock *lk);
+int locked(struct thread_mutex *m);
+
+void
+thread_spin_init(struct thread_spinlock *lk, char *name)
+{
+  lk->locked = 0;
+  lk->name = name;
+  lk->owner_pid = 0;    // no thread has pid 0
+}
+
+// Acquire the lock.
+// Loops (spins) until the lock is acquired.
+void
+thread_spin_lock(struct thread_spinlock *lk)
+{
+  if(holding_thread_spinlock(lk)){
+    printf("thread_spin_lock: %s held\n", lk->name);
+    exit(-1);
+  }
+
+  // On RISC-V, sync_lock_test_and_set turns into an atomic swap.
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    ;
+
+  // No loads or stores of the critical section
+  // may move above this point.
+  __sync_synchronize();
+
+  lk->owner_pid = gettid();
+}
+
+// Release the lock.
+void
+thread_spin_unlock(struct thread_spinlock *lk)
+{
+  if(!holding_thread_spinlock(lk)){
+    printf("thread_spin_unlock: %s not held\n", lk->name);
+    exit(-1);
+  }
+
+  lk->owner_pid = 0;
+
+  // All stores of the critical section must be
+  // visible before the lock is seen to be free.
+  __sync_synchronize();
+
+  __sync_lock_release(&lk->locked);
+}
+
+// Check whether this thread is holding the lock.
+int
+holding_thread_spinlock(struct thread_spinlock *lk)
+{
+  return lk->locked && lk->owner_pid == gettid();
+}
+
+void
+thread_mutex_init(struct thread_mutex *m, char *name)
+{
+  m->state = 0;
+  m->name = name;
+  m->owner_pid = 0;
+}
+
+// Acquire the mutex, sleeping while someone
+// else has it. An uncontended acquire and release
+// make no system calls; once a thread has had to
+// wait, state stays 2 so that the release wakes it.
+void
+thread_mutex_lock(struct thread_mutex *m)
+{
+  uint c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) != 0){
+    if(c != 2)
+      c = __sync_lock_test_and_set(&m->state, 2);
+    while(c != 0){
+      futex_wait(&m->state, 2);
+      c = __sync_lock_test_and_set(&m->state, 2);
+    }
+  }
+  __sync_synchronize();
+  m->owner_pid = gettid();
+}
+
+void
+thread_mutex_unlock(struct thread_mutex *m)
+{
+  if(!locked(m)){
+    printf("thread_mutex_unlock: %s not held\n", m->name);
+    exit(-1);
+  }
+  m->owner_pid = 0;
+  __sync_synchronize();
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+// Is the mutex held by this thread?
+int
+locked(struct thread_mutex *m)
+{
+  return m->state && m->owner_pid == gettid();
+}
+
+// Condition variable. Waiters sleep in the kernel on the
+// wait queue for the address of waiters, which cond_wait()
+// joins as it releases the mutex. There is no limit on how
+// many threads may wait.
+struct thread_cond_var {
+  uint waiters;       // Threads in or on their way to cond_wait()
+};
+
+void
+thread_cv_init(struct thread_cond_var *cv)
+{
+  cv->waiters = 0;
+}
+
+// Atomically release mlock and sleep until signalled,
+// then take mlock again.
+void
+thread_cv_wait(struct thread_cond_var *cv, struct thread_mutex *mlock)
+{
+  if(!locked(mlock)){
+    printf("thread_cv_wait: %s not held\n", mlock->name);
+    exit(-1);
+  }
+  __sync_fetch_and_add(&cv->waiters, 1);
+  mlock->owner_pid = 0;
+  __sync_synchronize();
+  cond_wait(&cv->waiters, &mlock->state);
+  thread_mutex_lock(mlock);
+  __sync_fetch_and_sub(&cv->waiters, 1);
+}
+
+// Wake the thread that has waited longest. Only threads
+// already waiting are sure to be woken, so call this with
+// the mutex held to be sure of waking one that is about
+// to wait.
+void
+thread_cv_signal(struct thread_cond_var *cv)
+{
+  if(cv->waiters)
+    futex_wake(&cv->waiters, 1);
+}
+
+// Wake every waiting thread.
+void
+thread_cv_broadcast(struct thread_cond_var *cv)
+{
+  if(cv->waiters)
+    futex_wake(&cv->waiters, 0x7fffffff);
+}
+
+// Counting semaphore.
+struct thread_sem {
+  int count;
+  struct thread_mutex semlock;
+  struct thread_cond_var cv;
+};
+
+int
+thread_sem_init(struct thread_sem *s, int value)
+{
+  s->count = value;
+  thread_mutex_init(&s->semlock, "sem");
+  thread_cv_init(&s->cv);
+  return 0;
+}
+
+// Increment the count and wake a waiter.
+void
+thread_sem_post(struct thread_sem *s)
+{
+  thread_mutex_lock(&s->semlock);
+  s->count++;
+  thread_cv_signal(&s->cv);
+  thread_mutex_unlock(&s->semlock);
+}
+
+// Wait for the count to be positive, then decrement it.
+void
+thread_sem_wait(struct thread_sem *s)
+{
+  thread_mutex_lock(&s->semlock);
+  while(s->count == 0)
+    thread_cv_wait(&s->cv, &s->semlock);
+  s->count--;
+  thread_mutex_unlock(&s->semlock);
+}
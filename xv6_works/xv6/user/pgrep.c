@@ -0,0 +1,177 @@
+// Parallel grep with the task pool.
+// pgrep [-r reps] pattern file ...
+//
+// Counts the lines of each file that match pattern, as grep
+// would print them (only ^ . * $ operators). Each file is
+// read into memory and its lines are split among workers
+// with parallel_for(). The count is done reps times on
+// pools of 1, 2, ... up to one worker per CPU, and each
+// time is printed with its speedup over one worker.
+
+#include "user/mythread.h"
+#include "user/taskpool.h"
+
+#define MAXFILES 16
+
+int match(char*, char*);
+
+struct input {
+  char *name;
+  char *text;        // lines, each ended by '\0'
+  int n;             // bytes of text
+  int count;         // lines that match
+};
+
+struct input files[MAXFILES];
+int nfile;
+char *pattern;
+
+// Count the lines that start in text[lo, hi).
+void
+grepchunk(int lo, int hi, void *arg)
+{
+  struct input *f = arg;
+  char *p = f->text + lo, *e = f->text + hi;
+  int count = 0;
+
+  // a line starting before lo is lo-1's chunk's.
+  if(lo > 0)
+    while(p < e && p[-1] != '\0')
+      p++;
+  while(p < e){
+    if(match(pattern, p))
+      count++;
+    p += strlen(p) + 1;
+  }
+  __sync_fetch_and_add(&f->count, count);
+}
+
+int
+readfile(struct input *f)
+{
+  struct stat st;
+  int fd, i, n;
+
+  if((fd = open(f->name, 0)) < 0)
+    return -1;
+  if(fstat(fd, &st) < 0 || (f->text = malloc(st.size + 1)) == 0){
+    close(fd);
+    return -1;
+  }
+  for(f->n = 0; f->n < st.size; f->n += n)
+    if((n = read(fd, f->text + f->n, st.size - f->n)) <= 0)
+      break;
+  close(fd);
+  for(i = 0; i < f->n; i++)
+    if(f->text[i] == '\n')
+      f->text[i] = '\0';
+  if(f->n == 0 || f->text[f->n-1] != '\0')
+    f->text[f->n++] = '\0';
+  return 0;
+}
+
+void
+run(int reps)
+{
+  int r, i;
+
+  for(r = 0; r < reps; r++)
+    for(i = 0; i < nfile; i++){
+      files[i].count = 0;
+      parallel_for(0, files[i].n, 512, grepchunk, &files[i]);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int reps = 50, mask, ncpu, w, i, t1 = 0, t;
+
+  if(argc > 2 && strcmp(argv[1], "-r") == 0){
+    reps = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < 3){
+    fprintf(2, "usage: pgrep [-r reps] pattern file ...\n");
+    exit(1);
+  }
+  pattern = argv[1];
+  for(i = 2; i < argc && nfile < MAXFILES; i++){
+    files[nfile].name = argv[i];
+    if(readfile(&files[nfile]) < 0){
+      printf("pgrep: cannot read %s\n", argv[i]);
+      exit(1);
+    }
+    nfile++;
+  }
+
+  mask = sched_getaffinity(0);
+  ncpu = 0;
+  for(i = 0; i < MAXWORKERS; i++)
+    if(mask & (1 << i))
+      ncpu++;
+
+  for(w = 1; w <= ncpu; w++){
+    if(pool_init(w) < 0){
+      printf("pgrep: can't start workers\n");
+      exit(1);
+    }
+    t = uptime();
+    run(reps);
+    t = uptime() - t;
+    pool_exit();
+    if(w == 1){
+      t1 = t;
+      for(i = 0; i < nfile; i++)
+        printf("%s: %d lines\n", files[i].name, files[i].count);
+    }
+    if(t == 0)
+      t = 1;
+    printf("  %d workers: %d ticks, speedup %d.%d%d\n", w, t,
+           t1 / t, (t1 * 10 / t) % 10, (t1 * 100 / t) % 10);
+  }
+  exit(0);
+}
+
+// Regexp matcher from Kernighan & Pike,
+// The Practice of Programming, Chapter 9, as in grep.c.
+
+int matchhere(char*, char*);
+int matchstar(int, char*, char*);
+
+int
+match(char *re, char *text)
+{
+  if(re[0] == '^')
+    return matchhere(re+1, text);
+  do{  // must look at empty string
+    if(matchhere(re, text))
+      return 1;
+  }while(*text++ != '\0');
+  return 0;
+}
+
+// matchhere: search for re at beginning of text
+int matchhere(char *re, char *text)
+{
+  if(re[0] == '\0')
+    return 1;
+  if(re[1] == '*')
+    return matchstar(re[0], re+2, text);
+  if(re[0] == '$' && re[1] == '\0')
+    return *text == '\0';
+  if(*text!='\0' && (re[0]=='.' || re[0]==*text))
+    return matchhere(re+1, text+1);
+  return 0;
+}
+
+// matchstar: search for c*re at beginning of text
+int matchstar(int c, char *re, char *text)
+{
+  do{  // a * matches zero or more instances
+    if(matchhere(re, text))
+      return 1;
+  }while(*text!='\0' && (*text++==c || c=='.'));
+  return 0;
+}
@@ -0,0 +1,99 @@
+// Cache-warm throughput with and without CPU pinning.
+// pinbench [rounds [kbytes]]
+//
+// One thread per CPU each sweeps its own buffer over and
+// over, sleeping a tick now and then so that idle CPUs get
+// the chance to steal it. The run is done twice: first with
+// the threads free to move, then with each pinned to its own
+// CPU by sched_setaffinity(), where it keeps a warm cache and
+// TLB. Note that qemu does not model caches, so there the
+// difference is only the cost of the moves themselves.
+
+#include "user/mythread.h"
+
+#define MAXTHREADS 8
+
+volatile int sink;
+int cpus[MAXTHREADS];   // the CPUs this process may run on
+
+struct worker {
+  int cpu;        // CPU to pin to, or -1
+  int rounds;
+  int kb;
+  char *buf;
+};
+
+void
+sweep(void *arg)
+{
+  struct worker *w = arg;
+  int r, i, sum = 0;
+
+  if(w->cpu >= 0 && sched_setaffinity(0, 1 << w->cpu) < 0){
+    printf("pinbench: can't pin to cpu %d\n", w->cpu);
+    thread_exit();
+  }
+  for(r = 0; r < w->rounds; r++){
+    for(i = 0; i < w->kb * 1024; i += 64)
+      sum += w->buf[i]++;
+    if(r % 16 == 15)
+      sleep(1);
+  }
+  sink = sum;
+  thread_exit();
+}
+
+int
+run(struct worker *w, int n, int pin)
+{
+  int tid[MAXTHREADS], i, t0;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    w[i].cpu = pin ? cpus[i] : -1;
+    tid[i] = thread_create(sweep, &w[i], malloc(4096));
+    if(tid[i] < 0){
+      printf("pinbench: thread_create failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < n; i++)
+    thread_join(tid[i]);
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct worker w[MAXTHREADS];
+  int rounds = 256, kb = 128, mask, n, i, t;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    kb = atoi(argv[2]);
+
+  // a fresh process may run on every CPU there is.
+  mask = sched_getaffinity(0);
+  n = 0;
+  for(i = 0; i < MAXTHREADS; i++)
+    if(mask & (1 << i))
+      cpus[n++] = i;
+
+  for(i = 0; i < n; i++){
+    w[i].rounds = rounds;
+    w[i].kb = kb;
+    if((w[i].buf = malloc(kb * 1024)) == 0){
+      printf("pinbench: out of memory\n");
+      exit(1);
+    }
+    memset(w[i].buf, 0, kb * 1024);
+  }
+
+  printf("pinbench: %d threads, %d rounds of %d KB\n", n, rounds, kb);
+  t = run(w, n, 0);
+  printf("  free:   %d ticks\n", t);
+  t = run(w, n, 1);
+  printf("  pinned: %d ticks\n", t);
+  exit(0);
+}
@@ -0,0 +1,63 @@
+// Scheduler ping-pong: pairs of processes bounce a byte
+// over two pipes. Each round trip is two sleeps, two
+// wakeups and at least two context switches, so the
+// time per round trip measures wakeup-to-run latency,
+// and the total rate context-switch throughput.
+// pingpong [rounds [pairs]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+void
+bounce(int rounds)
+{
+  int ab[2], ba[2], i;
+  char c = 0;
+
+  if(pipe(ab) < 0 || pipe(ba) < 0){
+    fprintf(2, "pingpong: pipe failed\n");
+    exit(1);
+  }
+  if(fork() == 0){
+    for(i = 0; i < rounds; i++){
+      if(read(ab[0], &c, 1) != 1 || write(ba[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < rounds; i++){
+    if(write(ab[1], &c, 1) != 1 || read(ba[0], &c, 1) != 1){
+      fprintf(2, "pingpong: lost the ball\n");
+      exit(1);
+    }
+  }
+  wait(0);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 10000, pairs = 1, t0, t, i;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    pairs = atoi(argv[2]);
+
+  t0 = uptime();
+  for(i = 0; i < pairs; i++){
+    if(fork() == 0)
+      bounce(rounds);
+  }
+  for(i = 0; i < pairs; i++)
+    wait(0);
+  t = uptime() - t0;
+
+  printf("pingpong: %d pairs x %d round trips: %d ticks", pairs, rounds, t);
+  if(t > 0)
+    printf(", %d round trips/tick", pairs * rounds / t);
+  printf("\n");
+  exit(0);
+}
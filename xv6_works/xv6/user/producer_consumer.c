@@ -0,0 +1,156 @@
+// Bounded buffer: producer threads pass items to consumer
+// threads through a queue of QSIZE slots, using a mutex and
+// two condition variables.
+// producer_consumer [producers [consumers [items]]]
+//
+// Each producer puts items items; the consumers take them
+// all. With many threads on each side most of them are
+// asleep in thread_cv_wait() at any time, so this measures
+// how quickly condition variables hand off between threads.
+
+#include "user/mythread.h"
+
+#define MAXTHREADS 16
+
+// The bounded buffer: a queue of up to QSIZE ints.
+#define QSIZE 16
+
+struct queue {
+  int arr[QSIZE];
+  int front;
+  int rear;
+  int size;
+};
+
+void
+queue_init(struct queue *q)
+{
+  q->front = 0;
+  q->rear = 0;
+  q->size = 0;
+}
+
+void
+push(struct queue *q, int x)
+{
+  if(q->size == QSIZE)
+    return;
+  q->arr[q->rear] = x;
+  q->rear = (q->rear + 1) % QSIZE;
+  q->size++;
+}
+
+int
+front(struct queue *q)
+{
+  if(q->size == 0)
+    return -1;
+  return q->arr[q->front];
+}
+
+void
+pop(struct queue *q)
+{
+  if(q->size == 0)
+    return;
+  q->front = (q->front + 1) % QSIZE;
+  q->size--;
+}
+
+struct queue q;
+struct thread_mutex mlock;      // protects q, sum and done
+struct thread_cond_var notfull;
+struct thread_cond_var notempty;
+int done;                       // producers have all finished
+int items;
+uint64 sum;
+
+void
+producer(void *arg)
+{
+  int i;
+
+  for(i = 1; i <= items; i++){
+    thread_mutex_lock(&mlock);
+    while(q.size == QSIZE)
+      thread_cv_wait(&notfull, &mlock);
+    push(&q, i);
+    thread_cv_signal(&notempty);
+    thread_mutex_unlock(&mlock);
+  }
+  thread_exit();
+}
+
+void
+consumer(void *arg)
+{
+  for(;;){
+    thread_mutex_lock(&mlock);
+    while(q.size == 0 && !done)
+      thread_cv_wait(&notempty, &mlock);
+    if(q.size == 0){
+      thread_mutex_unlock(&mlock);
+      break;
+    }
+    sum += front(&q);
+    pop(&q);
+    thread_cv_signal(&notfull);
+    thread_mutex_unlock(&mlock);
+  }
+  thread_exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int np = 4, nc = 4, i, t0, t;
+  int ptid[MAXTHREADS], ctid[MAXTHREADS];
+
+  items = 1000;
+  if(argc > 1)
+    np = atoi(argv[1]);
+  if(argc > 2)
+    nc = atoi(argv[2]);
+  if(argc > 3)
+    items = atoi(argv[3]);
+  if(np < 1 || np > MAXTHREADS || nc < 1 || nc > MAXTHREADS){
+    printf("producer_consumer: 1 to %d threads on each side\n", MAXTHREADS);
+    exit(1);
+  }
+
+  queue_init(&q);
+  thread_mutex_init(&mlock, "mlock");
+  thread_cv_init(&notfull);
+  thread_cv_init(&notempty);
+
+  t0 = uptime();
+  for(i = 0; i < nc; i++)
+    if((ctid[i] = thread_create(consumer, 0, malloc(4096))) < 0)
+      goto fail;
+  for(i = 0; i < np; i++)
+    if((ptid[i] = thread_create(producer, 0, malloc(4096))) < 0)
+      goto fail;
+  for(i = 0; i < np; i++)
+    thread_join(ptid[i]);
+
+  // wake the consumers waiting for more.
+  thread_mutex_lock(&mlock);
+  done = 1;
+  thread_cv_broadcast(&notempty);
+  thread_mutex_unlock(&mlock);
+  for(i = 0; i < nc; i++)
+    thread_join(ctid[i]);
+  t = uptime() - t0;
+
+  if(sum != (uint64)np * items * (items + 1) / 2){
+    printf("producer_consumer: items lost\n");
+    exit(1);
+  }
+  printf("producer_consumer: %d producers, %d consumers, %d items: %d ticks\n",
+         np, nc, np * items, t);
+  exit(0);
+
+fail:
+  printf("producer_consumer: thread_create failed\n");
+  exit(1);
+}
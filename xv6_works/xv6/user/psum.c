@@ -0,0 +1,89 @@
+// Parallel sum of an array with the task pool.
+// psum [n [reps]]
+//
+// Sums n ints reps times, first in a plain loop, then with
+// parallel_for() on pools of 1, 2, ... up to one worker per
+// CPU, and prints each time and its speedup over the loop.
+// Run with different CPUS= to see how it scales.
+
+#include "user/mythread.h"
+#include "user/taskpool.h"
+
+int *a;
+uint64 total;
+
+void
+sumrange(int lo, int hi, void *arg)
+{
+  uint64 s = 0;
+  int i;
+
+  for(i = lo; i < hi; i++)
+    s += a[i];
+  __sync_fetch_and_add(&total, s);
+}
+
+// Print t0/t to two places.
+void
+speedup(int t0, int t)
+{
+  if(t == 0)
+    t = 1;
+  printf("%d.%d%d", t0 / t, (t0 * 10 / t) % 10, (t0 * 100 / t) % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 1 << 18, reps = 20, mask, ncpu, w, r, i, t0, t;
+  uint64 want;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    reps = atoi(argv[2]);
+  if((a = malloc(n * sizeof(int))) == 0){
+    printf("psum: out of memory\n");
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    a[i] = i % 1000;
+
+  mask = sched_getaffinity(0);
+  ncpu = 0;
+  for(i = 0; i < MAXWORKERS; i++)
+    if(mask & (1 << i))
+      ncpu++;
+
+  printf("psum: %d ints, %d times\n", n, reps);
+  t0 = uptime();
+  for(r = 0; r < reps; r++){
+    total = 0;
+    sumrange(0, n, 0);
+  }
+  t0 = uptime() - t0;
+  want = total;
+  printf("  loop:      %d ticks\n", t0);
+
+  for(w = 1; w <= ncpu; w++){
+    if(pool_init(w) < 0){
+      printf("psum: can't start workers\n");
+      exit(1);
+    }
+    t = uptime();
+    for(r = 0; r < reps; r++){
+      total = 0;
+      parallel_for(0, n, n / (8 * w) + 1, sumrange, 0);
+    }
+    t = uptime() - t;
+    pool_exit();
+    if(total != want){
+      printf("psum: got %l, want %l\n", total, want);
+      exit(1);
+    }
+    printf("  %d workers: %d ticks, speedup ", w, t);
+    speedup(t0, t);
+    printf("\n");
+  }
+  exit(0);
+}
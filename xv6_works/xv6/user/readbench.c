@@ -0,0 +1,86 @@
+// Multi-threaded file system read throughput.
+// readbench [ops [file]]
+//
+// 1, 2, ... up to one thread per CPU each open, read and
+// close the same file ops times, so that they all look up
+// the same path (iget(), bget() hits) and copy out to the
+// same address space at once. A lookup-heavy load like this
+// is what the reader-writer itable, bcache and mm locks are
+// for; run it on kernels with and without them to compare,
+// and under lockstat to see where the waiting is.
+
+#include "user/mythread.h"
+#include "kernel/fcntl.h"
+
+#define MAXTHREADS 8
+
+struct worker {
+  int ops;
+  char *file;
+  int failed;
+};
+
+void
+reader(void *arg)
+{
+  struct worker *w = arg;
+  char buf[512];
+  int i, fd;
+
+  for(i = 0; i < w->ops; i++){
+    if((fd = open(w->file, O_RDONLY)) < 0){
+      w->failed = 1;
+      break;
+    }
+    if(read(fd, buf, sizeof(buf)) < 0)
+      w->failed = 1;
+    close(fd);
+  }
+  thread_exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct worker w[MAXTHREADS];
+  int tid[MAXTHREADS];
+  int ops = 2000, mask, ncpu, n, i, t0, t;
+  char *file = "README";
+
+  if(argc > 1)
+    ops = atoi(argv[1]);
+  if(argc > 2)
+    file = argv[2];
+
+  mask = sched_getaffinity(0);
+  ncpu = 0;
+  for(i = 0; i < MAXTHREADS; i++)
+    if(mask & (1 << i))
+      ncpu++;
+
+  printf("readbench: %d opens+reads of %s per thread\n", ops, file);
+  for(n = 1; n <= ncpu; n++){
+    t0 = uptime();
+    for(i = 0; i < n; i++){
+      w[i].ops = ops;
+      w[i].file = file;
+      w[i].failed = 0;
+      tid[i] = thread_create(reader, &w[i], malloc(4096));
+      if(tid[i] < 0){
+        printf("readbench: thread_create failed\n");
+        exit(1);
+      }
+    }
+    for(i = 0; i < n; i++)
+      thread_join(tid[i]);
+    t = uptime() - t0;
+    for(i = 0; i < n; i++)
+      if(w[i].failed){
+        printf("readbench: can't read %s\n", file);
+        exit(1);
+      }
+    printf("  %d threads: %d ticks, %d ops/tick\n", n, t,
+           t ? n * ops / t : n * ops);
+  }
+  exit(0);
+}
@@ -0,0 +1,87 @@
+// Interactive response under CPU load, for comparing
+// the round-robin and MLFQ (make MLFQ=1) schedulers.
+// schedbench [hogs [rounds]]
+//
+// Starts hogs CPU-bound children, then times an interactive
+// loop that sleeps a tick and does a little work, rounds
+// times. With nothing else running each round takes about
+// one tick. The hogs report how many loops they got through,
+// so the cost to throughput shows as well.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/sched.h"
+#include "user/user.h"
+
+volatile int sink;
+
+void
+work(int n)
+{
+  for(int i = 0; i < n; i++)
+    sink += i;
+}
+
+// Spin until uptime() reaches end, then
+// write the number of loops done to fd.
+void
+hog(int end, int fd)
+{
+  int loops = 0;
+
+  while(uptime() < end){
+    work(10000);
+    loops++;
+  }
+  write(fd, &loops, sizeof(loops));
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int hogs = 4, rounds = 100, fds[2], i, t0, t, loops, total;
+
+  if(argc > 1)
+    hogs = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(pipe(fds) < 0){
+    fprintf(2, "schedbench: pipe failed\n");
+    exit(1);
+  }
+
+  // the hogs outlast the timed loop, whatever share it gets.
+  t0 = uptime();
+  for(i = 0; i < hogs; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "schedbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      hog(t0 + 2*rounds + 20, fds[1]);
+  }
+  sleep(10);   // let the hogs sink to the bottom level
+
+  t0 = uptime();
+  for(i = 0; i < rounds; i++){
+    sleep(1);
+    work(1000);
+  }
+  t = uptime() - t0;
+
+  total = 0;
+  for(i = 0; i < hogs; i++){
+    if(read(fds[0], &loops, sizeof(loops)) != sizeof(loops)){
+      fprintf(2, "schedbench: lost a hog\n");
+      exit(1);
+    }
+    total += loops;
+    wait(0);
+  }
+  printf("schedbench: %d hogs, class %d\n", hogs, getsched(0));
+  printf("  interactive: %d rounds in %d ticks\n", rounds, t);
+  printf("  hogs: %d loops\n", total);
+  exit(0);
+}
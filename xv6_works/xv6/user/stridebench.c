@@ -0,0 +1,88 @@
+// Proportional share: CPU-bound children with different
+// tickets run side by side; under the stride scheduler
+// (make STRIDE=1) the ticks each gets should follow its
+// tickets. Boot with CPUS=1, or the children just spread
+// out over the CPUs and each gets one to itself.
+// stridebench [seconds [tickets ...]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NCHILD 8
+
+volatile int sink;
+
+struct report {
+  int tickets;
+  int loops;
+  int ran;        // ticks, from getruntime()
+};
+
+void
+spin(int tickets, int end, int fd)
+{
+  struct report r;
+
+  r.tickets = tickets;
+  r.loops = 0;
+  while(uptime() < end){
+    for(int i = 0; i < 10000; i++)
+      sink += i;
+    r.loops++;
+  }
+  r.ran = getruntime(0);
+  write(fd, &r, sizeof(r));
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int tickets[NCHILD] = { 100, 200, 300 };
+  int n = 3, secs = 5, fds[2], end, i, total;
+  struct report r[NCHILD];
+
+  if(argc > 1)
+    secs = atoi(argv[1]);
+  if(argc > 2){
+    n = 0;
+    for(i = 2; i < argc && n < NCHILD; i++)
+      tickets[n++] = atoi(argv[i]);
+  }
+  if(pipe(fds) < 0){
+    fprintf(2, "stridebench: pipe failed\n");
+    exit(1);
+  }
+
+  end = uptime() + secs * 10;   // a tick is about 100 ms
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "stridebench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      if(settickets(tickets[i]) < 0){
+        fprintf(2, "stridebench: bad tickets %d\n", tickets[i]);
+        exit(1);
+      }
+      spin(tickets[i], end, fds[1]);
+    }
+  }
+
+  total = 0;
+  for(i = 0; i < n; i++){
+    if(read(fds[0], &r[i], sizeof(r[i])) != sizeof(r[i])){
+      fprintf(2, "stridebench: lost a child\n");
+      exit(1);
+    }
+    total += r[i].tickets;
+    wait(0);
+  }
+  printf("stridebench: %d children, %d seconds\n", n, secs);
+  for(i = 0; i < n; i++)
+    printf("  tickets %d (%d%%): ran %d ticks, %d loops\n",
+           r[i].tickets, r[i].tickets * 100 / total, r[i].ran, r[i].loops);
+  exit(0);
+}
@@ -0,0 +1,281 @@
+// A fixed pool of worker threads that run short tasks,
+// so that a program does not pay for a thread_create()
+// per task. Include once, after mythread.h.
+//
+// pool_init(n) starts n-1 workers; the thread that called
+// it counts as worker 0, and it and the workers are the
+// only threads that may call task_spawn() and task_wait().
+// Each worker has a Chase-Lev deque of tasks: the owner
+// pushes and pops at the bottom, and a worker with nothing
+// to do steals from the top of another's. Idle workers
+// sleep in futex_wait().
+
+#define MAXWORKERS 8
+#define POOLSTACK (16*1024)   // stack bytes per worker
+#define DEQSIZE 256           // power of two
+
+#define TASK_PENDING 0
+#define TASK_DONE    1
+#define TASK_WAITED  2        // pending, and task_wait() sleeps on it
+
+// A task, owned by whoever spawns it, which must
+// task_wait() for it before the memory is reused.
+struct task {
+  void (*fn)(void*);
+  void *arg;
+  uint state;                 // TASK_PENDING etc.
+};
+
+struct deque {
+  int top;                    // next to steal; only grows
+  int bottom;                 // next free slot, at the owner's end
+  struct task *t[DEQSIZE];
+};
+
+struct {
+  int n;                      // workers, counting worker 0
+  int pid[MAXWORKERS];        // thread id of each worker
+  int tid[MAXWORKERS];        // for thread_join()
+  struct deque dq[MAXWORKERS];
+  uint work;                  // bumped by each spawn
+  uint idle;                  // workers asleep on work
+  int stop;                   // set by pool_exit()
+} pool;
+
+// Put t at the bottom of d. Only d's owner may push.
+// Returns -1 if d is full.
+int
+dq_push(struct deque *d, struct task *t)
+{
+  int b = d->bottom;
+
+  if(b - *(volatile int*)&d->top >= DEQSIZE)
+    return -1;
+  d->t[b & (DEQSIZE-1)] = t;
+  __sync_synchronize();
+  *(volatile int*)&d->bottom = b + 1;
+  return 0;
+}
+
+// Take the task at the bottom of d, the one pushed last.
+// Only d's owner may pop.
+struct task*
+dq_pop(struct deque *d)
+{
+  int b = d->bottom - 1, top;
+  struct task *t;
+
+  *(volatile int*)&d->bottom = b;
+  __sync_synchronize();
+  top = *(volatile int*)&d->top;
+  if(top > b){
+    // empty.
+    *(volatile int*)&d->bottom = b + 1;
+    return 0;
+  }
+  t = d->t[b & (DEQSIZE-1)];
+  if(top == b){
+    // the last one: a thief may be taking it too.
+    if(!__sync_bool_compare_and_swap(&d->top, top, top + 1))
+      t = 0;
+    *(volatile int*)&d->bottom = b + 1;
+  }
+  return t;
+}
+
+// Take the task at the top of d, the one pushed first.
+// Returns 0 if d is empty or another thread got there first.
+struct task*
+dq_steal(struct deque *d)
+{
+  int top = *(volatile int*)&d->top;
+  struct task *t;
+
+  __sync_synchronize();
+  if(top >= *(volatile int*)&d->bottom)
+    return 0;
+  t = d->t[top & (DEQSIZE-1)];
+  if(!__sync_bool_compare_and_swap(&d->top, top, top + 1))
+    return 0;
+  return t;
+}
+
+// Which worker is this?
+int
+task_self(void)
+{
+  int tid = gettid(), i;
+
+  for(i = 1; i < pool.n; i++)
+    if(pool.pid[i] == tid)
+      return i;
+  return 0;
+}
+
+// Find a task for worker me: its own newest,
+// or else the oldest of some other worker's.
+struct task*
+task_find(int me)
+{
+  struct task *t;
+  int i;
+
+  if((t = dq_pop(&pool.dq[me])) != 0)
+    return t;
+  for(i = 1; i < pool.n; i++)
+    if((t = dq_steal(&pool.dq[(me + i) % pool.n])) != 0)
+      return t;
+  return 0;
+}
+
+void
+task_run(struct task *t)
+{
+  t->fn(t->arg);
+  __sync_synchronize();
+  if(__sync_lock_test_and_set(&t->state, TASK_DONE) == TASK_WAITED)
+    futex_wake(&t->state, MAXWORKERS);
+}
+
+// Queue fn(arg) to run as task t. If this worker's
+// deque is full, runs it now instead.
+void
+task_spawn(struct task *t, void (*fn)(void*), void *arg)
+{
+  t->fn = fn;
+  t->arg = arg;
+  t->state = TASK_PENDING;
+  if(dq_push(&pool.dq[task_self()], t) < 0){
+    task_run(t);
+    return;
+  }
+  __sync_fetch_and_add(&pool.work, 1);
+  if(pool.idle)
+    futex_wake(&pool.work, 1);
+}
+
+// Wait for t to finish, running other tasks meanwhile.
+void
+task_wait(struct task *t)
+{
+  struct task *x;
+  int me = task_self();
+
+  while(*(volatile uint*)&t->state != TASK_DONE){
+    if((x = task_find(me)) != 0){
+      task_run(x);
+      continue;
+    }
+    if(__sync_val_compare_and_swap(&t->state, TASK_PENDING, TASK_WAITED) == TASK_DONE)
+      break;
+    futex_wait(&t->state, TASK_WAITED);
+  }
+  __sync_synchronize();
+}
+
+void
+task_worker(void *arg)
+{
+  int me = (int)(uint64)arg;
+  struct task *t;
+  uint work;
+
+  pool.pid[me] = gettid();
+  for(;;){
+    // a spawn after this read makes futex_wait() return.
+    work = *(volatile uint*)&pool.work;
+    if((t = task_find(me)) != 0){
+      task_run(t);
+      continue;
+    }
+    if(pool.stop)
+      break;
+    __sync_fetch_and_add(&pool.idle, 1);
+    futex_wait(&pool.work, work);
+    __sync_fetch_and_sub(&pool.idle, 1);
+  }
+  thread_exit();
+}
+
+// Stop the workers, once every task has finished.
+void
+pool_exit(void)
+{
+  int i;
+
+  pool.stop = 1;
+  __sync_fetch_and_add(&pool.work, 1);
+  futex_wake(&pool.work, MAXWORKERS);
+  for(i = 1; i < pool.n; i++)
+    thread_join(pool.tid[i]);
+  pool.n = 0;
+}
+
+// Start a pool of n workers, counting the caller.
+// Returns the number started, or -1.
+int
+pool_init(int n)
+{
+  int i;
+
+  if(n < 1)
+    n = 1;
+  if(n > MAXWORKERS)
+    n = MAXWORKERS;
+  memset(&pool, 0, sizeof(pool));
+  pool.n = n;
+  pool.pid[0] = gettid();
+  for(i = 1; i < n; i++){
+    pool.tid[i] = thread_create_attr(task_worker, (void*)(uint64)i, POOLSTACK);
+    if(pool.tid[i] < 0){
+      // stop and join the workers already started.
+      pool.n = i;
+      pool_exit();
+      return -1;
+    }
+  }
+  return n;
+}
+
+// parallel_for() splits [lo, hi) in halves, as tasks,
+// down to pieces of at most grain, and calls fn on each.
+struct pfor {
+  int lo, hi, grain;
+  void (*fn)(int, int, void*);
+  void *arg;
+};
+
+void
+pfor_task(void *a)
+{
+  struct pfor *r = a, upper;
+  struct task t;
+
+  if(r->hi - r->lo <= r->grain){
+    r->fn(r->lo, r->hi, r->arg);
+    return;
+  }
+  upper = *r;
+  upper.lo = r->lo + (r->hi - r->lo) / 2;
+  task_spawn(&t, pfor_task, &upper);
+  r->hi = upper.lo;
+  pfor_task(r);
+  task_wait(&t);
+}
+
+// Call fn(l, h, arg) on pieces [l, h) that together
+// cover [lo, hi), in parallel, and wait for them all.
+void
+parallel_for(int lo, int hi, int grain, void (*fn)(int, int, void*), void *arg)
+{
+  struct pfor r;
+
+  if(grain < 1)
+    grain = 1;
+  r.lo = lo;
+  r.hi = hi;
+  r.grain = grain;
+  r.fn = fn;
+  r.arg = arg;
+  pfor_task(&r);
+}
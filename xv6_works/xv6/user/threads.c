@@ -0,0 +1,74 @@
+// Two threads add to a shared balance under a spin lock.
+// The total should come out as the sum of the amounts.
+
+#include "user/mythread.h"
+
+struct thread_spinlock lock;
+struct thread_spinlock out_lock;
+
+struct balance {
+  char name[32];
+  int amount;
+};
+
+volatile int total_balance = 0;
+
+volatile unsigned int
+delay(unsigned int d)
+{
+  unsigned int i;
+
+  for(i = 0; i < d; i++)
+    __asm volatile("nop" ::: );
+  return i;
+}
+
+void
+do_work(void *arg)
+{
+  struct balance *b = (struct balance*) arg;
+  int i, old;
+
+  thread_spin_lock(&out_lock);
+  printf("Starting do_work: s:%s\n", b->name);
+  thread_spin_unlock(&out_lock);
+
+  for(i = 0; i < b->amount; i++){
+    thread_spin_lock(&lock);
+    old = total_balance;
+    delay(100000);
+    total_balance = old + 1;
+    thread_spin_unlock(&lock);
+  }
+
+  thread_spin_lock(&out_lock);
+  printf("Done s:%s\n", b->name);
+  thread_spin_unlock(&out_lock);
+
+  thread_exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct balance b1 = {"b1", 3200};
+  struct balance b2 = {"b2", 2800};
+  void *s1, *s2;
+  int thread1, thread2, r1, r2;
+
+  s1 = malloc(4096);  // one page of stack each
+  s2 = malloc(4096);
+
+  thread_spin_init(&lock, "balance");
+  thread_spin_init(&out_lock, "print");
+
+  thread1 = thread_create(do_work, (void*)&b1, s1);
+  thread2 = thread_create(do_work, (void*)&b2, s2);
+
+  r1 = thread_join(thread1);
+  r2 = thread_join(thread2);
+
+  printf("Threads finished: (%d):%d, (%d):%d, shared balance:%d\n",
+         thread1, r1, thread2, r2, total_balance);
+  exit(0);
+}
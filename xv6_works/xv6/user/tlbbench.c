@@ -0,0 +1,69 @@
+// TLB reach: sweep the same amount of memory mapped two ways.
+// tlbbench [megabytes [rounds]]
+//
+// The heap is grown to a 2 MiB boundary first, so the kernel
+// maps it with 2 MiB megapages on first touch. An anonymous
+// mmap() region always uses 4 KiB pages. Both are faulted in
+// before timing; each round then loads one word per 4 KiB
+// page, which mostly measures TLB misses.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE      4096
+#define SUPERPGSIZE (512*PGSIZE)
+
+volatile int sink;
+
+int
+sweep(char *a, int sz, int rounds)
+{
+  int t0, sum = 0;
+
+  t0 = uptime();
+  for(int r = 0; r < rounds; r++)
+    for(int i = 0; i < sz; i += PGSIZE)
+      sum += a[i];
+  sink = sum;   // keep the loads
+  return uptime() - t0;
+}
+
+void
+fill(char *a, int sz)
+{
+  for(int i = 0; i < sz; i += PGSIZE)
+    a[i] = 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 32, rounds = 2000, sz;
+  uint64 top;
+  char *heap, *map;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  sz = mb * 1024 * 1024;
+
+  top = (uint64)sbrk(0);
+  if(top % SUPERPGSIZE)
+    sbrk(SUPERPGSIZE - top % SUPERPGSIZE);
+  heap = sbrk(sz);
+  map = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(heap == (char*)-1 || map == (char*)-1){
+    fprintf(2, "tlbbench: can't allocate 2 x %d MB\n", mb);
+    exit(1);
+  }
+  fill(heap, sz);
+  fill(map, sz);
+
+  printf("tlbbench: %d MB, %d rounds\n", mb, rounds);
+  printf("  heap (2 MiB pages): %d ticks\n", sweep(heap, sz, rounds));
+  printf("  mmap (4 KiB pages): %d ticks\n", sweep(map, sz, rounds));
+  exit(0);
+}
@@ -2,6 +2,7 @@
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
 #include "user/user.h"
+#include "kernel/tls.h"
 
 //
 // wrapper so that it's OK if main() does not call exit().
@@ -145,3 +146,20 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// This thread's TLS block, which tp points at.
+struct tls*
+gettls(void)
+{
+  struct tls *t;
+
+  asm volatile("mv %0, tp" : "=r" (t));
+  return t;
+}
+
+// This thread's pid, without a system call.
+int
+gettid(void)
+{
+  return gettls()->tid;
+}
@@ -1,4 +1,9 @@
 struct stat;
+struct kmemstat;
+struct syscall_stat;
+struct timespec;
+struct lockstat;
+struct tls;
 
 // system calls
 int fork(void);
@@ -22,6 +27,26 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int kmemstat(struct kmemstat*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int thread_create(void(*)(void*), void*, void*);
+int thread_join(int);
+void thread_exit(void) __attribute__((noreturn));
+int futex_wait(uint*, uint);
+int futex_wake(uint*, int);
+int setsched(int, int);
+int getsched(int);
+int settickets(int);
+int getruntime(int);
+int sched_setaffinity(int, uint);
+int sched_getaffinity(int);
+int history(int, struct syscall_stat*);
+int clock_gettime(int, struct timespec*);
+int nanosleep(const struct timespec*);
+int lockstat(struct lockstat*, int, int);
+int cond_wait(uint*, uint*);
+int thread_create_attr(void(*)(void*), void*, uint);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,3 +64,5 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+struct tls* gettls(void);
+int gettid(void);
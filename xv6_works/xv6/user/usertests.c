@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/time.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -108,6 +109,12 @@ copyout(char *s)
       printf("read(pipe, %p, 8192) returned %d, not -1 or 0\n", addr, n);
       exit(1);
     }
+    // the failed read must leave the byte in the pipe.
+    char c = 0;
+    if(read(fds[0], &c, 1) != 1 || c != 'x'){
+      printf("read(pipe, %p, 8192) lost the pipe's data\n", addr);
+      exit(1);
+    }
     close(fds[0]);
     close(fds[1]);
   }
@@ -2057,6 +2064,425 @@ sbrkbasic(char *s)
   exit(xstatus);
 }
 
+// fork a process that holds more than half of memory;
+// only possible if fork shares pages copy-on-write.
+void
+cowfork(char *s)
+{
+  enum { BIG=80*1024*1024 };
+  char *a;
+  int i, pid, xstatus;
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < BIG; i += 4096)
+    a[i] = i / 4096;
+
+  for(int n = 0; n < 3; n++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(i = 0; i < 64*4096; i += 4096)
+        a[i] = 'c';
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+
+  // the children's stores must not show through.
+  for(i = 0; i < BIG; i += 4096){
+    if(a[i] != (char)(i / 4096)){
+      printf("%s: parent's page %d changed\n", s, i / 4096);
+      exit(1);
+    }
+  }
+  sbrk(-BIG);
+}
+
+// mmap() of a file, private and shared, and of anonymous memory.
+void
+mmaptest(char *s)
+{
+  enum { SZ = 2*4096 + 100 };
+  char *a, *b, *c;
+  int fd, i, pid, xstatus;
+
+  fd = open("mmapf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmapf failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i % BUFSZ] = 'a' + i % 26;
+  for(i = 0; i < SZ; i += BUFSZ)
+    write(fd, buf, SZ - i < BUFSZ ? SZ - i : BUFSZ);
+
+  // private: stores stay in this process.
+  a = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(a == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(a[i] != 'a' + i % 26){
+      printf("%s: mmap private: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(a[SZ] != 0){
+    printf("%s: mmap private: page past EOF not zero\n", s);
+    exit(1);
+  }
+  a[0] = 'X';
+
+  // shared: stores reach the file on munmap.
+  b = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(b == (char*)-1 || b == a){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  if(b[0] != 'a'){
+    printf("%s: private store visible in shared mapping\n", s);
+    exit(1);
+  }
+  b[1] = 'Y';
+  b[4096] = 'Z';
+
+  // another shared mapping, and a forked child's, see
+  // the same pages.
+  c = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(c == (char*)-1 || c[1] != 'Y'){
+    printf("%s: shared mappings of one file differ\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    c[2] = 'W';
+    exit(0);
+  }
+  wait(0);
+  if(b[2] != 'W'){
+    printf("%s: child's store not seen in shared mapping\n", s);
+    exit(1);
+  }
+  if(munmap(c, SZ) < 0 || munmap(b, SZ) < 0 || munmap(a, SZ) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapf", O_RDONLY);
+  if(read(fd, buf, 4097) != 4097 || buf[0] != 'a' || buf[1] != 'Y' ||
+     buf[2] != 'W' || buf[4096] != 'Z'){
+    printf("%s: shared stores not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapf");
+
+  // anonymous memory, inherited by fork; gone after munmap.
+  a = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(a == (char*)-1){
+    printf("%s: mmap anonymous failed\n", s);
+    exit(1);
+  }
+  a[4096] = 42;
+  if(munmap(a + 2*4096, 4096) < 0){
+    printf("%s: partial munmap failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(a[0] != 0 || a[4096] != 42)
+      exit(1);
+    a[2*4096] = 1;   // unmapped; should be killed
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: child of mmap region wrong, status %d\n", s, xstatus);
+    exit(1);
+  }
+  munmap(a, 2*4096);
+}
+
+// threads share one address space: heap a thread
+// grows with sbrk() is there for the others too.
+char *threadmm_p[4];
+
+void
+threadmm_fn(void *arg)
+{
+  int i = (int)(uint64)arg;
+  char *p;
+
+  p = sbrk(2*4096);
+  if(p != (char*)-1){
+    p[0] = p[4096] = 'a' + i;
+    threadmm_p[i] = p;
+  }
+  thread_exit();
+}
+
+void
+threadmm(char *s)
+{
+  enum { N = 4 };
+  int i, tid[N];
+  char *p;
+
+  for(i = 0; i < N; i++){
+    tid[i] = thread_create(threadmm_fn, (void*)(uint64)i, sbrk(4096));
+    if(tid[i] < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(thread_join(tid[i]) != tid[i]){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    p = threadmm_p[i];
+    if(p == 0 || p[0] != 'a' + i || p[4096] != 'a' + i){
+      printf("%s: thread %d heap not shared\n", s, i);
+      exit(1);
+    }
+  }
+}
+
+// futex_wait() returns at once if the word has changed,
+// and otherwise sleeps until a futex_wake() on it, even
+// if a fork() in between makes the word's page
+// copy-on-write, so that the store moves it.
+uint futexword;
+
+void
+futexwaiter(void *arg)
+{
+  while(futexword == 0)
+    futex_wait(&futexword, 0);
+  thread_exit();
+}
+
+void
+futextest(char *s)
+{
+  int tid, pid;
+
+  futexword = 1;
+  if(futex_wait(&futexword, 0) != -1){
+    printf("%s: futex_wait slept on a changed word\n", s);
+    exit(1);
+  }
+  futexword = 0;
+  tid = thread_create(futexwaiter, 0, sbrk(4096));
+  if(tid < 0){
+    printf("%s: thread_create failed\n", s);
+    exit(1);
+  }
+  sleep(2);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  futexword = 1;
+  futex_wake(&futexword, 1);
+  wait(0);
+  if(thread_join(tid) != tid){
+    printf("%s: thread_join failed\n", s);
+    exit(1);
+  }
+}
+
+// a thread from thread_create_attr() can use all of
+// the stack it asked for, and one that runs off the end
+// hits the guard page and is killed, leaving the rest of
+// the process alone.
+int
+threadstack_use(int n)
+{
+  volatile char buf[512];
+
+  buf[0] = n;
+  if(n == 0)
+    return buf[0];
+  return threadstack_use(n - 1) + buf[0];
+}
+
+void
+threadstack_fn(void *arg)
+{
+  threadstack_use((int)(uint64)arg);
+  exit(0);
+}
+
+void
+threadstack(char *s)
+{
+  int i, tid, xstatus;
+
+  for(i = 0; i < 4; i++){
+    // 64 frames of over 512 bytes: most of 64 KB.
+    tid = thread_create_attr(threadstack_fn, (void*)64, 64*1024);
+    if(tid < 0){
+      printf("%s: thread_create_attr failed\n", s);
+      exit(1);
+    }
+    if(thread_join(tid) != tid){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+  }
+
+  // a thread can't report how it died to thread_join(),
+  // so run the overflow in a child, where it takes the
+  // main thread's place.
+  int pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    tid = thread_create_attr(threadstack_fn, (void*)1000, 4096);
+    if(tid < 0)
+      exit(1);
+    thread_join(tid);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: overflowing thread took the process down\n", s);
+    exit(1);
+  }
+}
+
+// gettid() reads the tid from the TLS block that tp points
+// at, which each thread, and each forked child, has its own of.
+int tlsok;
+
+void
+tlsthread(void *arg)
+{
+  tlsok = gettid() == getpid() && gettls() != (struct tls*)arg;
+  thread_exit();
+}
+
+void
+tlstest(char *s)
+{
+  int tid, pid, xstatus;
+
+  if(gettid() != getpid()){
+    printf("%s: main thread's gettid() is wrong\n", s);
+    exit(1);
+  }
+  tid = thread_create(tlsthread, gettls(), sbrk(4096));
+  if(tid < 0){
+    printf("%s: thread_create failed\n", s);
+    exit(1);
+  }
+  thread_join(tid);
+  if(!tlsok){
+    printf("%s: thread's gettid() is wrong\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(gettid() == getpid() ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child's gettid() is wrong\n", s);
+    exit(1);
+  }
+}
+
+// nanosleep() should sleep at least as long as asked:
+// a fifth of a tick, then a second and a half, across a
+// tv_sec boundary and many ticks.
+void
+nanosleeptest(char *s)
+{
+  struct timespec t0, t1, req[2] = { { 0, 20*1000*1000 }, { 1, 500*1000*1000 } };
+  uint64 ns, want;
+  int i;
+
+  for(i = 0; i < 2; i++){
+    if(clock_gettime(CLOCK_MONOTONIC, &t0) < 0 ||
+       nanosleep(&req[i]) < 0 ||
+       clock_gettime(CLOCK_MONOTONIC, &t1) < 0){
+      printf("%s: failed\n", s);
+      exit(1);
+    }
+    ns = (t1.tv_sec - t0.tv_sec) * 1000000000 + t1.tv_nsec - t0.tv_nsec;
+    want = req[i].tv_sec * 1000000000 + req[i].tv_nsec;
+    if(ns < want){
+      printf("%s: slept %l ns, asked for %l\n", s, ns, want);
+      exit(1);
+    }
+  }
+}
+
+// copyout() and copyin() to a heap megapage must reach the
+// right 4 KiB page of it, not the first.
+void
+megacopy(char *s)
+{
+  enum { MEG2 = 2*1024*1024 };
+  char *old, *base, *p, b[9];
+  int fds[2];
+
+  old = sbrk(0);
+  if(sbrk(3*MEG2) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  base = (char*)(((uint64)old + MEG2 - 1) & ~(uint64)(MEG2 - 1));
+  p = base + 3*4096 + 100;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "megapage", 9);
+  if(read(fds[0], p, 9) != 9 || strcmp(p, "megapage") != 0 || base[100] != 0){
+    printf("%s: copyout to megapage went astray\n", s);
+    exit(1);
+  }
+  p[0] = 'M';
+  if(write(fds[1], p, 9) != 9 || read(fds[0], b, 9) != 9 || strcmp(b, "Megapage") != 0){
+    printf("%s: copyin from megapage went astray\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-3*MEG2);
+}
+
 void
 sbrkmuch(char *s)
 {
@@ -2620,6 +3046,14 @@ struct test {
   {forktest, "forktest"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
+  {megacopy, "megacopy"},
+  {cowfork, "cowfork"},
+  {mmaptest, "mmap"},
+  {threadmm, "threadmm"},
+  {futextest, "futex"},
+  {threadstack, "threadstack"},
+  {tlstest, "tls"},
+  {nanosleeptest, "nanosleep"},
   {kernmem, "kernmem"},
   {MAXVAplus, "MAXVAplus"},
   {sbrkfail, "sbrkfail"},
@@ -36,3 +36,23 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("kmemstat");
+entry("mmap");
+entry("munmap");
+entry("thread_create");
+entry("thread_join");
+entry("thread_exit");
+entry("futex_wait");
+entry("futex_wake");
+entry("setsched");
+entry("getsched");
+entry("settickets");
+entry("getruntime");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("history");
+entry("clock_gettime");
+entry("nanosleep");
+entry("lockstat");
+entry("cond_wait");
+entry("thread_create_attr");